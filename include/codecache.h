@@ -0,0 +1,43 @@
+#pragma once
+// Persistent code cache (src/codecache.c): trace recordings saved per program
+// image, so a later run of the same program starts with its traces compiled.
+#include <stddef.h>
+#include <stdint.h>
+
+/* bump when the engine's trace or decode rules change; part of every key */
+#define UM_ENGINE_VERSION 1u
+
+typedef struct {
+    uint32_t start; // first pc of the block
+    uint32_t jump; // pc of its loadprog, or of the head it fell into
+    uint32_t target; // recorded jump target
+    uint32_t guard; // 0: fell through into another trace's head
+} CCBlock;
+
+typedef struct {
+    uint32_t head; // entry pc
+    uint32_t nblocks; // blocks following the previous trace's
+} CCTrace;
+
+/* an opened cache file (read-only mapping) */
+typedef struct {
+    void *map;
+    size_t size;
+    const CCTrace *traces;
+    uint32_t ntraces;
+    const CCBlock *blocks;
+    uint32_t nblocks;
+} CodeCache;
+
+/* key for a program image: hash of its words, length and UM_ENGINE_VERSION */
+uint64_t cc_key(const uint32_t *words, size_t n);
+
+/* map DIR/<key>.umcc. Returns 0 on success, -1 if missing, stale or
+   malformed (the caller just runs without it). */
+int cc_open(CodeCache *cc, const char *dir, uint64_t key, uint32_t nwords);
+void cc_close(CodeCache *cc);
+
+/* write DIR/<key>.umcc atomically (temp file + rename). Returns 0 or -1. */
+int cc_save(const char *dir, uint64_t key, uint32_t nwords,
+            const CCTrace *traces, uint32_t ntraces,
+            const CCBlock *blocks, uint32_t nblocks);
@@ -0,0 +1,13 @@
+#pragma once
+// Breakpoint debugger (src/debugger.c): the --break list and the command
+// prompt a hit stops at. The breakpoints themselves are patched into the
+// threaded engine's decoded stream (engine_break).
+#include <stdint.h>
+
+/* set the --break=PC[,PC...] list and open the command input (cmds, or the
+   controlling terminal if NULL); 0, or -1 with a message on stderr */
+int debug_open(const char *breaks, const char *cmds);
+
+/* the engine stopped at pc, before its op ran (r: the registers, which
+   commands may change): read commands until continue (0) or step (1) */
+int debug_stop(uint32_t pc, uint32_t *r);
@@ -0,0 +1,28 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+// Threaded engine (src/engine.c): runs array 0 from a pre-decoded handler
+// stream instead of the reference switch loop in loader.c.
+
+typedef struct {
+    int jit; // record hot paths across jumps and run them as traces
+    int ret_stack; // predict traced returns with a shadow return stack (experimental)
+    const char *cache_dir; // persist traces per program image here (NULL: off)
+    const uint16_t *sel; // boot image operand selectors from a .umc, or NULL
+    int stats; // print what the decoder and trace compiler did at halt (stderr)
+} EngineConfig;
+
+/* Run the booted program from pc 0 with all registers 0 until halt.
+   Returns the process exit status; spec failures exit via fail_and_exit. */
+int engine_run(const EngineConfig *cfg);
+
+/* Free this thread's engine state (decoded stream, traces; saves the code
+   cache). engine_run does this at halt; a --pipe stage that stops early
+   calls it itself. */
+void engine_release(void);
+
+/* Breakpoints (--break, src/debugger.c): set (on) or clear the one at pc;
+   1 if that changed anything. Takes effect at once, also from inside a
+   stop; a pc past the end of array 0 waits for a longer program. */
+int engine_break(uint32_t pc, int on);
+size_t engine_breaks(const uint32_t **pcs); // the current set, unordered
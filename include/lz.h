@@ -0,0 +1,17 @@
+#pragma once
+// Small LZ77 block compressor (src/lz.c) for binary traces: greedy matching
+// through one hash table, byte-aligned tokens, no entropy coding. Built for
+// streaming speed rather than ratio; the delta-encoded records it is fed are
+// already small, and loops make them highly repetitive.
+#include <stddef.h>
+#include <stdint.h>
+
+/* worst-case compressed size of n input bytes */
+#define LZ_BOUND(n) ((n) + (n) / 255u + 16u)
+
+/* compress src[0..n) into dst (room for LZ_BOUND(n)); returns the size */
+size_t lz_compress(const uint8_t *src, size_t n, uint8_t *dst);
+
+/* decompress src[0..n) into dst[0..cap); returns the size, or (size_t)-1
+   if the input is malformed or does not fit */
+size_t lz_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap);
@@ -0,0 +1,13 @@
+#pragma once
+// Background reclaimer (src/reclaim.c): large array memory goes back to the
+// system on a helper thread so `dealloc` and `loadprog` don't stall in munmap.
+#include <stddef.h>
+
+#define RECLAIM_MIN_BYTES ((size_t)1 << 20) // smaller blocks are freed inline
+
+/* free(p) (p holds bytes bytes), on the reclaimer thread if it is large */
+void reclaim_free(void *p, size_t bytes);
+
+/* a queued block of exactly bytes bytes, taken back before the reclaimer
+   frees it (its contents are stale), or NULL */
+void *reclaim_take(size_t bytes);
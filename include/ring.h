@@ -0,0 +1,68 @@
+#pragma once
+// Single-producer/single-consumer byte ring (src/ring.c): joins one
+// pipeline stage's `out` to the next stage's `in` (loader --pipe).
+//
+// The fast paths are a buffer access, a release store of the index and a
+// relaxed flag check (no fences); a side only takes the lock when it has to
+// sleep (ring full or empty) or to wake a sleeping peer.
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h> // EOF
+#include <pthread.h>
+
+#include "um.h"
+
+#define UM_RING_SIZE 65536u // bytes, power of two
+
+typedef struct UMRing {
+    _Alignas(64) atomic_size_t head; // bytes written (producer)
+    size_t tail_seen; // producer's last look at tail
+    _Alignas(64) atomic_size_t tail; // bytes read (consumer)
+    size_t head_seen; // consumer's last look at head
+    _Alignas(64) atomic_int want_space; // producer sleeps until half is free
+    atomic_int want_data; // consumer sleeps until a byte arrives
+    atomic_int closed; // producer is done
+    atomic_int abandoned; // consumer is done
+    pthread_mutex_t mu;
+    pthread_cond_t cv;
+    unsigned char buf[UM_RING_SIZE];
+} UMRing;
+
+UMRing *ring_new(void);
+void ring_free(UMRing *r);
+void ring_close(UMRing *r); // producer: no more bytes (reader sees EOF when drained)
+void ring_abandon(UMRing *r); // consumer: no more reads (writer's puts fail)
+
+/* bulk transfer for the threads that pump stdin/stdout: ring_write blocks
+   until all n bytes are in (-1 if abandoned), ring_read until at least one
+   byte is there (0 at EOF) */
+int ring_write(UMRing *r, const unsigned char *src, size_t n);
+size_t ring_read(UMRing *r, unsigned char *dst, size_t max);
+
+/* slow paths: wait for room / data, or wake the other side */
+int ring_wait_space(UMRing *r); // 0, or -1 if abandoned
+int ring_wait_data(UMRing *r); // 0, or -1 at EOF
+void ring_wake(UMRing *r);
+
+/* append one byte; 0, or -1 if the reader is gone */
+static inline int ring_put(UMRing *r, unsigned char b) {
+    size_t h = atomic_load_explicit(&r->head, memory_order_relaxed);
+    if (UNLIKELY(h - r->tail_seen == UM_RING_SIZE) && ring_wait_space(r) != 0) return -1;
+    r->buf[h & (UM_RING_SIZE - 1)] = b;
+    atomic_store_explicit(&r->head, h + 1, memory_order_release);
+    if (UNLIKELY(atomic_load_explicit(&r->want_data, memory_order_relaxed))) ring_wake(r);
+    return 0;
+}
+
+/* next byte, or EOF once the writer closed and everything was read */
+static inline int ring_get(UMRing *r) {
+    size_t t = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    if (UNLIKELY(t == r->head_seen) && ring_wait_data(r) != 0) return EOF;
+    int b = r->buf[t & (UM_RING_SIZE - 1)];
+    atomic_store_explicit(&r->tail, t + 1, memory_order_release);
+    if (UNLIKELY(atomic_load_explicit(&r->want_space, memory_order_relaxed)) &&
+        atomic_load_explicit(&r->head, memory_order_relaxed) - (t + 1) <= UM_RING_SIZE / 2) {
+        ring_wake(r);
+    }
+    return b;
+}
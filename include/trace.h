@@ -2,11 +2,59 @@
 #include <stdio.h>
 
 #ifdef TRACE
+    #include <stdatomic.h>
+    #include <stddef.h>
+    #include <stdint.h>
+    #include <string.h>
+
+    #include "um.h"
+    #include "tracefile.h"
+
     extern int g_trace_enabled;
     #define TRACEF(...) do { \
         if (g_trace_enabled) fprintf(stderr, __VA_ARGS__); \
     } while (0)
+
+    extern const char *g_trace_path; // --trace=FILE: binary .umt instead of text
+
+    /* --trace is asynchronous (src/trace.c): the VM thread only stores raw
+       records (tracefile.h) into a ring, and a writer thread formats them
+       to stderr or encodes them into g_trace_path. */
+    #define TRACE_RING_RECS 4096u // power of two
+
+    typedef struct TraceRing {
+        _Alignas(64) atomic_size_t head; // records pushed (VM thread)
+        size_t tail_seen; // VM thread's last look at tail
+        uint32_t lost; // drops since the last pushed record
+        int drop; // UM_TRACE_POLICY=drop: full ring loses records
+        _Alignas(64) atomic_size_t tail; // records written out (writer)
+        atomic_int closed;
+        TraceRec buf[TRACE_RING_RECS];
+    } TraceRing;
+
+    extern UM_TLS TraceRing *g_trace_ring;
+
+    void trace_start(void); // this thread traces from now on (starts its writer)
+    void trace_stop(void); // drain, join the writer, report drops (no-op if not started)
+    int trace_wait_space(TraceRing *q); // full ring: 1 once there is room, 0 to drop
+
+    /* the per-instruction cost of --trace: a record copy and an index store */
+    static inline void trace_push(uint32_t kind, uint32_t pc, uint32_t w, const uint32_t r[8]) {
+        TraceRing *q = g_trace_ring;
+        size_t h = atomic_load_explicit(&q->head, memory_order_relaxed);
+        if (UNLIKELY(h - q->tail_seen == TRACE_RING_RECS) && !trace_wait_space(q)) {
+            q->lost++;
+            return;
+        }
+        TraceRec *e = &q->buf[h & (TRACE_RING_RECS - 1)];
+        e->kind = kind;
+        e->pc = pc;
+        e->w = w;
+        e->dropped = q->lost;
+        memcpy(e->r, r, sizeof e->r);
+        q->lost = 0;
+        atomic_store_explicit(&q->head, h + 1, memory_order_release);
+    }
 #else
     #define TRACEF(...) do {} while (0)
 #endif
-    
\ No newline at end of file
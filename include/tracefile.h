@@ -0,0 +1,45 @@
+#pragma once
+// Instruction trace records and their two outputs (src/tracefile.c): the
+// --trace text and compressed binary .umt files (loader --trace=FILE, read
+// back by um-trace). Shared by the loader's trace writer and the reader.
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* one traced instruction: its pc and word and the registers *before* it,
+   so an instruction's results (register deltas, alloc ids) come from the
+   record after it */
+enum { TR_INSN, TR_STOP }; // TR_STOP: UM_TRACE_LIMIT reached
+
+typedef struct {
+    uint32_t kind, pc, w;
+    uint32_t dropped; // records lost right before this one (drop policy)
+    uint32_t r[8];
+} TraceRec;
+
+/* the text trace's line for one record (no newline); returns its length
+   as snprintf does */
+int trace_format(char *buf, size_t cap, const TraceRec *e);
+
+/* text trace: tt_record formats into an internal buffer that goes out in
+   large writes; tt_finish reports drops after the last record (lost) and
+   overall, flushes and frees. */
+typedef struct TraceText TraceText;
+TraceText *tt_new(FILE *out);
+void tt_record(TraceText *t, const TraceRec *e);
+void tt_flush(TraceText *t);
+void tt_finish(TraceText *t, uint64_t lost);
+
+/* binary trace (.umt): records are delta-encoded against the previous one
+   and compressed in blocks. umt_close writes the trailer (lost as above). */
+typedef struct UMTWriter UMTWriter;
+UMTWriter *umt_create(const char *path); // NULL (errno set) if unwritable
+int umt_record(UMTWriter *w, const TraceRec *e); // 0, or -1 on a write error
+int umt_close(UMTWriter *w, uint64_t lost);
+
+/* umt_next: 1 and the next record, 0 at the trailer (*lost set), -1 if the
+   file is truncated or malformed */
+typedef struct UMTReader UMTReader;
+UMTReader *umt_open(FILE *in); // NULL if not a .umt
+int umt_next(UMTReader *r, TraceRec *e, uint64_t *lost);
+void umt_free(UMTReader *r);
@@ -0,0 +1,82 @@
+#pragma once
+// Shared VM state for the emulator's translation units (loader.c owns the
+// definitions; engine.c runs programs against the same array registry).
+// VM state is per thread (UM_TLS), so --pipe can run one VM per thread.
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__GNUC__)
+# define ALWAYS_INLINE inline __attribute__((always_inline))
+# define UNLIKELY(x) __builtin_expect(!!(x), 0)
+# define NORETURN __attribute__((noreturn))
+# define NOINLINE __attribute__((noinline))
+#else
+# define ALWAYS_INLINE inline
+# define UNLIKELY(x) (x)
+# define NORETURN
+# define NOINLINE
+#endif
+
+/* per-VM globals: one VM per thread */
+#define UM_TLS _Thread_local
+
+/* trap word stored one past the end of array 0 (opcode 14 is not a UM op) */
+#define UM_SENTINEL 0xE0000000u
+
+/* field extractors */
+static inline unsigned OPC(uint32_t w) { return w >> 28; } // bits 28..31
+static inline unsigned ABC_A(uint32_t w) { return (w >> 6) & 7u; } // bits 6..8
+static inline unsigned ABC_B(uint32_t w) {return (w >> 3) & 7u; } // bits 3..5
+static inline unsigned ABC_C(uint32_t w) { return (w >> 0) & 7u; } // bits 0..2
+static inline unsigned LI_A(uint32_t w) { return (w >> 25) & 7u; } // bits 25..27
+static inline unsigned LI_VAL(uint32_t w) {return w & 0x1FFFFFFu; } // bits 0..24
+
+/*--------------------------- array registry (“heap”) --------------------------*/
+typedef struct {
+    uint32_t *data; // NULL if length 0 or after free
+    size_t len; // number of words
+    int active; // 1 if allocated (including id 0 for program), 0 otherwise
+} UMArray;
+
+extern UM_TLS UMArray *g_arr; // ids: 0 .. g_arr_len - 1
+extern UM_TLS size_t g_arr_len;
+
+uint32_t id_acquire(void); // fresh id, reusing freed ones first
+void id_release(uint32_t id); // return an id to the free stack
+void arrays_destroy(void); // free every array and reset the registry
+void program_replace(uint32_t *data, size_t len); // new array 0 (len + sentinel words, malloc'd)
+
+/* streaming load (--stream): while g_stream_len != 0 array 0 is that long,
+   but only its first g_arr[0].len words have been read so far */
+extern size_t g_stream_len;
+size_t stream_wait(size_t pc); // block until word pc is in (or the load ends); returns g_arr[0].len
+int stream_reach(uint32_t id, size_t off); // 1 if mem[id][off] is valid once loaded (after waiting)
+void stream_finish(void); // wait for the whole program
+
+/* program I/O: stdin/stdout, or the rings joining --pipe stages (ring.h) */
+struct UMRing;
+extern UM_TLS struct UMRing *g_in_ring; // NULL: stdin
+extern UM_TLS struct UMRing *g_out_ring; // NULL: stdout
+void pipe_broken(void) NORETURN; // `out` after the next stage halted: end this stage
+
+/* --watch id:offset[:len]: report every aupd into mem[id][off, off + len)
+   (and, for id 0, program swaps). Set once before any VM starts. */
+typedef struct {
+    int on;
+    uint32_t id, off, len;
+} UMWatch;
+extern UMWatch g_watch;
+static inline int watch_covers(uint32_t id, uint32_t off) {
+    return id == g_watch.id && off - g_watch.off < g_watch.len;
+}
+void watch_hit(uint32_t pc, uint32_t id, uint32_t off, uint32_t old, uint32_t val);
+
+/* --output: where `out` goes when there is no ring (benchmarks, checks) */
+enum { UM_OUT_STDOUT, UM_OUT_NULL, UM_OUT_HASH };
+extern UM_TLS int g_out_mode;
+extern UM_TLS uint64_t g_out_hash; // UM_OUT_HASH: FNV-1a of every byte so far
+#define UM_HASH_INIT 0xCBF29CE484222325ull // FNV-1a, 64-bit
+#define UM_HASH_STEP(h, byte) (((h) ^ (byte)) * 0x100000001B3ull)
+
+/* VM-spec failure path: print, cleanup, exit */
+void fail_and_exit(const char *msg) NORETURN;
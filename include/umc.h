@@ -0,0 +1,53 @@
+#pragma once
+// Pre-decoded program images (.umc, src/umc.c): the words of a .um file in
+// native byte order plus a per-word operand selector table, laid out so the
+// loader can mmap the file and use it as array 0 without any transformation.
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "um.h"
+
+/* per op: the operand bits its handlers are specialized on, as they sit in
+   a selector (A,B,C for ABC ops; B,C for alloc/loadprog; C for
+   dealloc/out/in; A for loadimm; 0 otherwise). Also the decoder's index
+   mask, so no selector indexes past an op's handler table. */
+static const uint16_t umc_sel_mask[16] = {
+    0x1FF, 0x1FF, 0x1FF, 0x1FF, 0x1FF, 0x1FF, 0x1FF, // ABC ops
+    0, 0x3F, 7, 7, 7, 0x3F, 7, 0, 0, // halt, alloc, dealloc/out/in, loadprog, loadimm (A), -
+};
+
+/* operand selector: op << 9 | the op's operand bits (umc_sel_mask) */
+static inline uint16_t umc_sel(uint32_t w) {
+    unsigned op = OPC(w);
+    uint32_t k = op == 13 ? LI_A(w) : w & umc_sel_mask[op]; // no branch per op
+    return (uint16_t)(op << 9 | k);
+}
+
+/* a mapped .umc (private writable mapping: writes are copy-on-write) */
+typedef struct {
+    void *map;
+    size_t size;
+    uint32_t *words; // nwords + 1 (last is UM_SENTINEL)
+    const uint16_t *sel; // nwords operand selectors
+    size_t nwords;
+} UMCImage;
+
+/* write a .umc for words[0..nwords). src is the stat of the .um it was made
+   from (recorded for staleness checks), or NULL if there is none. */
+int umc_write(const char *path, const uint32_t *words, size_t nwords, const struct stat *src);
+
+/* map a .umc. Returns 0 on success, 1 if it is stale against src (non-NULL
+   and recorded at write time), -1 if missing or malformed. Selectors are
+   not checked against their words: the decoder masks each one to its
+   table (umc_sel_mask). */
+int umc_map(UMCImage *img, const char *path, const struct stat *src);
+/* map a shared image (umc_shm_path) for the .um described by src. Only a
+   regular file owned by this user and writable by no one else is used.
+   Returns 0, or -1 if it is missing, stale, foreign or malformed. */
+int umc_map_shared(UMCImage *img, const char *path, const struct stat *src);
+void umc_unmap(UMCImage *img);
+
+/* path of the shared image for the .um described by src: DIR/um-<key>.umc,
+   keyed by its device, inode, size and mtime. Returns 0, or -1 if too long. */
+int umc_shm_path(char *buf, size_t cap, const char *dir, const struct stat *src);
@@ -0,0 +1,18 @@
+#pragma once
+// Zeroed allocations for `alloc` (src/zero.c). By default calloc, which for
+// large arrays means fresh demand-zero pages; --zero=parallel instead reuses
+// a just-freed block of the same size, zeroed on several threads with
+// non-temporal stores.
+#include <stddef.h>
+
+#define ZERO_PAR_MIN ((size_t)16 << 20) // bytes; smaller arrays always calloc
+
+enum { UM_ZERO_CALLOC, UM_ZERO_PARALLEL };
+extern int g_zero_mode; // --zero
+
+/* calloc(n, 4) under g_zero_mode; NULL on OOM */
+void *zero_alloc(size_t n);
+
+/* memset(p, 0, bytes) split over threads threads (0: one per CPU; at most
+   16, and one per 16 MiB), each streaming its slice past the cache */
+void zero_fill(void *p, size_t bytes, unsigned threads);
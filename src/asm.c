@@ -20,12 +20,15 @@
 //   - Comments:   everything after ";;" on a line is ignored
 //
 // CLI:
-//   usage: asm <input.uma> [-o output.um]
-//   If -o is omitted, defaults to "a.um".
+//   usage: asm <input.uma> [-o output.um] [--umc]
+//   If -o is omitted, defaults to "a.um" ("a.umc" with --umc).
+//   -o - writes the .um to stdout (e.g. asm x.uma -o - | loader -).
 //
 // Output format:
 //   - Each instruction encoded as a single 32-bit word.
 //   - Words are written big-endian (MSB first), as required by .um.
+//   - --umc writes a pre-decoded .umc image instead (native-endian words
+//     plus operand table, see include/umc.h) that the loader maps directly.
 //
 // Error handling: fails fast with line/column context when possible.
 // ------------------------------------------------------------
@@ -47,6 +50,8 @@
 #include <ctype.h>
 #include <stdarg.h>
 
+#include "umc.h"
+
 #if defined(__GNUC__)
 # define NORETURN __attribute__((noreturn))
 #else
@@ -321,25 +326,35 @@ int main(int argc, char **argv) {
     const char *in = NULL, *out = NULL;
     
     if (argc < 2) {
-        fprintf(stderr, "usage: %s <input.uma> [-o output.um]\n", argv[0]);
+        fprintf(stderr, "usage: %s <input.uma> [-o output.um] [--umc]\n", argv[0]);
         return 2;
     }
 
     in = argv[1];
 
+    int umc = 0;
+
     for (int i = 2; i < argc; ++i) {
         if (!strcmp(argv[i], "-o") && i + 1 < argc) {
             out =  argv[++i];
+        } else if (!strcmp(argv[i], "--umc")) {
+            umc = 1;
         } else {
             fprintf(stderr, "unknown arg: %s\n", argv[i]);
             return 2;
         }
     }
 
-    if (!out) { out = "a.um"; }
+    if (!out) { out = umc ? "a.umc" : "a.um"; }
 
     FILE *fin = xfopen(in, "r");
-    FILE *fout = xfopen(out, "wb");
+    int to_stdout = strcmp(out, "-") == 0;
+    if (umc && to_stdout) die("--umc needs an output file");
+    FILE *fout = umc ? NULL : to_stdout ? stdout : xfopen(out, "wb");
+
+    // --umc: collect the words, the image is written in one go at the end
+    uint32_t *words = NULL;
+    size_t nwords = 0, capwords = 0;
 
     /*------------------------------- Pass 1 -------------------------------*/
     // Scan file, collect labels with the PC (instruction count).
@@ -517,13 +532,28 @@ int main(int argc, char **argv) {
             failf(in, lineno, "unknown mnemonic '%s'", mn);
         }
         // emit the encoded word
-        emit_be32(fout, word);
+        if (!umc) {
+            emit_be32(fout, word);
+            continue;
+        }
+        if (nwords == capwords) {
+            capwords = capwords ? capwords * 2 : 1024;
+            uint32_t *nw = (uint32_t*)realloc(words, capwords * sizeof(uint32_t));
+            if (!nw) die("out of memory");
+            words = nw;
+        }
+        words[nwords++] = word;
     }
 
     free(line2);
     labels_free();
 
     fclose(fin);
-    fclose(fout);
+    if (umc) {
+        if (umc_write(out, words, nwords, NULL) != 0) die("cannot write .umc output");
+        free(words);
+    } else {
+        fclose(fout);
+    }
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,712 @@
+// UM batch runner
+// ------------------------------------------------------------
+// Runs one .um program over many independent inputs, up to BATCH_LANES
+// instances at a time in lockstep: each UM register is a vector holding
+// that register for every lane, so one fetch and one dispatch drive the
+// whole group. The vectors are GCC/Clang vector extensions: two SSE2/NEON
+// registers per UM register in the default build, one AVX2 register with
+// BATCH_ARCH=-march=native (see the Makefile).
+//
+// Divergence:
+//   - Every lane has its own pc. The group runs the smallest pc among its
+//     lanes, with only the lanes sitting there enabled; the others are
+//     masked off (register writes are blended, not stored) until the
+//     running lanes reach their pc and they rejoin. A branch that splits a
+//     group therefore reconverges at the first pc both sides get to.
+//   - Memory, allocation and I/O ops loop over the enabled lanes, each
+//     against that lane's own heap and input/output buffers.
+//   - A lane that changes its own code (a store into array 0, or a loadprog
+//     from a nonzero id) can no longer share the group's fetch. It leaves
+//     the group and finishes on the scalar interpreter, as does the last
+//     lane left in a group.
+//
+// The scalar interpreter is also the baseline: --scalar runs every
+// instance on it (K independent VMs), --compare runs both ways, checks
+// that outputs and failures agree, and reports the two times.
+//
+// Each instance reads its own input (a file, or one line of --lines=FILE)
+// and its output is printed in input order, or written to DIR/<n>.out.
+// A failing instance reports "batch: <input>: <reason>" and makes the exit
+// status 1; the others are unaffected.
+//
+// CLI:
+//   usage: batch [--scalar | --compare] [--stats] [--lanes=K] [-o DIR]
+//                <program.um> (--lines=FILE | <input>...)
+// ------------------------------------------------------------
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif // clock_gettime
+
+#ifndef _FILE_OFFSET_BITS
+#define _FILE_OFFSET_BITS 64
+#endif // 64 bit off_t for large files
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "um.h"
+
+#define BATCH_LANES 8 // 8 x 32-bit: one AVX2 register
+
+typedef uint32_t vword __attribute__((vector_size(4 * BATCH_LANES)));
+
+/*--------------------------- tiny fail helpers ---------------------------*/
+static void die(const char *msg) NORETURN;
+static void die(const char *msg) {
+    fprintf(stderr, "batch: %s\n", msg);
+    exit(1);
+}
+
+static void *xrealloc(void *p, size_t n) {
+    p = realloc(p, n);
+    if (!p) die("out of memory");
+    return p;
+}
+
+/*------------------------------ file input -------------------------------*/
+
+/* whole file into a malloc'd buffer ("-" is stdin) */
+static unsigned char *slurp(const char *path, size_t *out_len) {
+    FILE *f = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "batch: cannot open %s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+
+    size_t len = 0, cap = 4096;
+    unsigned char *buf = xrealloc(NULL, cap);
+    for (;;) {
+        size_t got = fread(buf + len, 1, cap - len, f);
+        len += got;
+        if (len < cap) break;
+        cap *= 2;
+        buf = xrealloc(buf, cap);
+    }
+    if (ferror(f)) die("read error");
+    if (f != stdin) fclose(f);
+
+    *out_len = len;
+    return buf;
+}
+
+/* the program, native endian, plus the sentinel word */
+static uint32_t *g_prog;
+static size_t g_prog_len;
+
+static void load_program(const char *path) {
+    size_t size;
+    unsigned char *b = slurp(path, &size);
+    if (size == 0 || (size & 3) != 0) die(".um size invalid");
+
+    g_prog_len = size / 4;
+    g_prog = xrealloc(NULL, (g_prog_len + 1) * sizeof *g_prog);
+    for (size_t i = 0; i < g_prog_len; ++i) {
+        const unsigned char *p = b + 4 * i;
+        g_prog[i] = (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+                    (uint32_t)p[2] << 8 | (uint32_t)p[3];
+    }
+    g_prog[g_prog_len] = UM_SENTINEL;
+    free(b);
+}
+
+/*--------------------------------- lanes ---------------------------------*/
+/* one program instance: its heap, I/O buffers and (outside a group) regs */
+
+enum { LANE_GROUP, LANE_SCALAR, LANE_HALTED, LANE_FAILED };
+
+typedef struct {
+    const unsigned char *in; // this instance's input (not owned)
+    size_t in_len, in_pos;
+    unsigned char *out;
+    size_t out_len, out_cap;
+
+    UMArray *arr; // ids 0 .. narr - 1; arr[0] is g_prog until own0
+    size_t narr, arr_cap;
+    uint32_t *free_ids; // LIFO stack of reusable ids
+    size_t nfree, free_cap;
+    int own0; // array 0 is a private copy
+
+    uint32_t regs[8]; // scalar state (valid once the lane left its group)
+    uint32_t pc;
+    int state;
+    const char *err; // LANE_FAILED: why
+} Lane;
+
+static void lane_init(Lane *L, const unsigned char *in, size_t in_len) {
+    memset(L, 0, sizeof *L);
+    L->in = in;
+    L->in_len = in_len;
+    L->arr_cap = 16;
+    L->arr = xrealloc(NULL, L->arr_cap * sizeof *L->arr);
+    L->arr[0] = (UMArray){ g_prog, g_prog_len, 1 };
+    L->narr = 1;
+    L->state = LANE_GROUP;
+}
+
+static void lane_destroy(Lane *L) {
+    for (size_t i = L->own0 ? 0 : 1; i < L->narr; ++i) free(L->arr[i].data);
+    free(L->arr);
+    free(L->free_ids);
+    free(L->out);
+}
+
+static const char *lane_alloc(Lane *L, uint32_t n, uint32_t *out_id) {
+    uint32_t *data = NULL;
+    if (n > 0 && !(data = calloc(n, sizeof *data))) return "alloc: OOM";
+
+    uint32_t id;
+    if (L->nfree) {
+        id = L->free_ids[--L->nfree];
+    } else {
+        if (L->narr == L->arr_cap) {
+            L->arr_cap *= 2;
+            L->arr = xrealloc(L->arr, L->arr_cap * sizeof *L->arr);
+        }
+        id = (uint32_t)L->narr++;
+    }
+    L->arr[id] = (UMArray){ data, n, 1 };
+    *out_id = id;
+    return NULL;
+}
+
+static const char *lane_free(Lane *L, uint32_t id) {
+    if (id == 0 || id >= L->narr || !L->arr[id].active) return "dealloc: invalid or inactive id";
+
+    free(L->arr[id].data);
+    L->arr[id] = (UMArray){ NULL, 0, 0 };
+    if (L->nfree == L->free_cap) {
+        L->free_cap = L->free_cap ? 2 * L->free_cap : 16;
+        L->free_ids = xrealloc(L->free_ids, L->free_cap * sizeof *L->free_ids);
+    }
+    L->free_ids[L->nfree++] = id;
+    return NULL;
+}
+
+static inline const char *lane_load(const Lane *L, uint32_t id, uint32_t off, uint32_t *v) {
+    if (id >= L->narr || !L->arr[id].active) return "index: inactive array";
+    if (off >= L->arr[id].len) return "index: offset OOB";
+    *v = L->arr[id].data[off];
+    return NULL;
+}
+
+static inline const char *lane_store(Lane *L, uint32_t id, uint32_t off, uint32_t v) {
+    if (id >= L->narr || !L->arr[id].active) return "update: inactive array";
+    if (off >= L->arr[id].len) return "update: offset OOB";
+    if (id == 0 && !L->own0) {
+        // first write to the shared program: take a private copy
+        uint32_t *copy = malloc((g_prog_len + 1) * sizeof *copy);
+        if (!copy) return "update: OOM";
+        memcpy(copy, g_prog, (g_prog_len + 1) * sizeof *copy);
+        L->arr[0].data = copy;
+        L->own0 = 1;
+    }
+    L->arr[id].data[off] = v;
+    return NULL;
+}
+
+/* duplicate mem[id] into array 0 (id != 0) */
+static const char *lane_loadprog(Lane *L, uint32_t id) {
+    if (id >= L->narr || !L->arr[id].active) return "loadprog: inactive id";
+
+    size_t n = L->arr[id].len;
+    uint32_t *dup = malloc((n + 1) * sizeof *dup);
+    if (!dup) return "loadprog: OOM";
+    if (n > 0) memcpy(dup, L->arr[id].data, n * sizeof *dup);
+    dup[n] = UM_SENTINEL;
+
+    if (L->own0) free(L->arr[0].data);
+    L->arr[0].data = dup;
+    L->arr[0].len = n;
+    L->own0 = 1;
+    return NULL;
+}
+
+static inline const char *lane_out(Lane *L, uint32_t v) {
+    if (v > 255u) return "output: value > 255";
+    if (L->out_len == L->out_cap) {
+        L->out_cap = L->out_cap ? 2 * L->out_cap : 256;
+        L->out = xrealloc(L->out, L->out_cap);
+    }
+    L->out[L->out_len++] = (unsigned char)v;
+    return NULL;
+}
+
+static inline uint32_t lane_in(Lane *L) {
+    return L->in_pos < L->in_len ? L->in[L->in_pos++] : 0xFFFFFFFFu;
+}
+
+/*--------------------------- scalar interpreter --------------------------*/
+/* Run L from L->regs / L->pc until it halts or fails. Returns the number
+   of instructions executed. */
+static uint64_t run_scalar(Lane *L) {
+    uint32_t *r = L->regs;
+    uint32_t pc = L->pc;
+    const char *err = NULL;
+    uint64_t n = 0;
+
+    for (;; ++n) {
+        if (UNLIKELY(pc >= L->arr[0].len)) {
+            err = "PC out of bounds at cycle start";
+            break;
+        }
+        uint32_t w = L->arr[0].data[pc++];
+        unsigned A = ABC_A(w), B = ABC_B(w), C = ABC_C(w);
+
+        switch (OPC(w)) {
+            case 0: if (r[C] != 0) r[A] = r[B]; break;
+            case 1: {
+                uint32_t v;
+                err = lane_load(L, r[B], r[C], &v);
+                r[A] = err ? r[A] : v;
+                break;
+            }
+            case 2: err = lane_store(L, r[A], r[B], r[C]); break;
+            case 3: r[A] = r[B] + r[C]; break;
+            case 4: r[A] = r[B] * r[C]; break;
+            case 5:
+                if (UNLIKELY(r[C] == 0)) err = "divide by zero";
+                else r[A] = r[B] / r[C];
+                break;
+            case 6: r[A] = ~(r[B] & r[C]); break;
+            case 7:
+                L->pc = pc - 1;
+                L->state = LANE_HALTED;
+                return n + 1;
+            case 8: err = lane_alloc(L, r[C], &r[B]); break;
+            case 9: err = lane_free(L, r[C]); break;
+            case 10: err = lane_out(L, r[C]); break;
+            case 11: r[C] = lane_in(L); break;
+            case 12:
+                if (r[B] != 0) err = lane_loadprog(L, r[B]);
+                pc = r[C];
+                break;
+            case 13: r[LI_A(w)] = LI_VAL(w); break;
+            default: err = "invalid opcode"; break;
+        }
+        if (UNLIKELY(err != NULL)) break;
+    }
+
+    L->pc = pc;
+    L->state = LANE_FAILED;
+    L->err = err;
+    return n;
+}
+
+/*-------------------------- lockstep (SIMD) groups -----------------------*/
+
+typedef struct {
+    uint64_t steps; // group instructions issued
+    uint64_t lane_insns; // instructions executed, summed over enabled lanes
+    uint64_t scalar_insns; // instructions run by lanes that left their group
+    uint64_t splits; // schedules that left some lanes waiting
+    uint64_t ejected; // lanes that finished on the scalar interpreter
+} BatchStats;
+
+typedef struct {
+    Lane *lane;
+    vword r[8]; // r[k][i]: register k of lane i
+    uint32_t lpc[BATCH_LANES]; // pc of each live lane while it is not running
+    unsigned live; // lanes still in the group
+    unsigned run; // lanes enabled at pc
+    vword runv; // run as a lane mask
+    unsigned nrun;
+    int masked; // some live lanes are waiting: writes must blend
+    uint32_t pc;
+    uint32_t wait_pc; // smallest waiting pc (UINT32_MAX: none)
+    BatchStats *st;
+} Group;
+
+static const vword LANE_BIT = {1, 2, 4, 8, 16, 32, 64, 128};
+
+/* lane bits -> lane mask (a macro: vector-valued functions change the ABI
+   without -mavx, which gcc warns about) */
+#define MASK_OF(bits) ((vword)((LANE_BIT & (bits)) != 0))
+
+#define FOR_LANES(i, bits) \
+    for (unsigned b_ = (bits), i; b_ && (i = (unsigned)__builtin_ctz(b_), 1); b_ &= b_ - 1)
+
+/* write val to the enabled lanes of dst */
+#define VSET(G, dst, val) do { \
+        vword v_ = (val); \
+        (dst) = (G)->masked ? ((v_ & (G)->runv) | ((dst) & ~(G)->runv)) : v_; \
+    } while (0)
+
+static void group_drop(Group *G, unsigned i) {
+    G->live &= ~(1u << i);
+    if (G->run & (1u << i)) {
+        G->run &= ~(1u << i);
+        G->runv = MASK_OF(G->run);
+        G->nrun--;
+    }
+}
+
+static void group_fail(Group *G, unsigned i, const char *err) {
+    G->lane[i].state = LANE_FAILED;
+    G->lane[i].err = err;
+    G->lane[i].pc = G->pc;
+    group_drop(G, i);
+}
+
+/* hand lane i to the scalar interpreter, resuming at pc */
+static void group_eject(Group *G, unsigned i, uint32_t pc) {
+    Lane *L = &G->lane[i];
+    for (unsigned k = 0; k < 8; ++k) L->regs[k] = G->r[k][i];
+    L->pc = pc;
+    L->state = LANE_SCALAR;
+    G->st->ejected++;
+    group_drop(G, i);
+}
+
+/* Pick the next pc: the smallest among the live lanes (their lpc must be
+   current). Returns 0 when the group is done. */
+static int group_schedule(Group *G) {
+    if (G->live == 0) return 0;
+    if ((G->live & (G->live - 1)) == 0) {
+        // a single lane runs faster without the vector bookkeeping
+        unsigned i = (unsigned)__builtin_ctz(G->live);
+        group_eject(G, i, G->lpc[i]);
+        return 0;
+    }
+
+    uint32_t pc = UINT32_MAX;
+    FOR_LANES(i, G->live) if (G->lpc[i] < pc) pc = G->lpc[i];
+
+    unsigned run = 0;
+    uint32_t wait = UINT32_MAX;
+    FOR_LANES(i, G->live) {
+        if (G->lpc[i] == pc) run |= 1u << i;
+        else if (G->lpc[i] < wait) wait = G->lpc[i];
+    }
+
+    G->pc = pc;
+    G->run = run;
+    G->runv = MASK_OF(run);
+    G->nrun = (unsigned)__builtin_popcount(run);
+    G->masked = run != G->live;
+    G->wait_pc = wait;
+    if (G->masked) G->st->splits++;
+    return 1;
+}
+
+/* record pc for the running lanes (before a reschedule) */
+static void group_park(Group *G) {
+    FOR_LANES(i, G->run) G->lpc[i] = G->pc;
+}
+
+/* Run lanes[0..n) from pc 0 in lockstep until each has halted, failed or
+   left for the scalar interpreter (which then finishes it). */
+static void run_group(Lane *lanes, unsigned n, BatchStats *st) {
+    Group g = { .lane = lanes, .st = st };
+    Group *G = &g;
+    G->live = n >= 32 ? ~0u : (1u << n) - 1;
+
+    int more = group_schedule(G);
+    while (more) {
+        if (UNLIKELY(G->pc == G->wait_pc)) {
+            // the running lanes caught up with waiting ones: merge
+            group_park(G);
+            if (!group_schedule(G)) break;
+        }
+        if (UNLIKELY(G->pc >= g_prog_len)) {
+            FOR_LANES(i, G->run) group_fail(G, i, "PC out of bounds at cycle start");
+            more = group_schedule(G);
+            continue;
+        }
+
+        uint32_t w = g_prog[G->pc];
+        unsigned A = ABC_A(w), B = ABC_B(w), C = ABC_C(w);
+        st->steps++;
+        st->lane_insns += G->nrun;
+
+        switch (OPC(w)) {
+            case 0: {
+                vword m = (vword)(G->r[C] != 0);
+                if (G->masked) m &= G->runv;
+                G->r[A] = (G->r[B] & m) | (G->r[A] & ~m);
+                break;
+            }
+            case 1:
+                FOR_LANES(i, G->run) {
+                    uint32_t v;
+                    const char *e = lane_load(&lanes[i], G->r[B][i], G->r[C][i], &v);
+                    if (UNLIKELY(e != NULL)) group_fail(G, i, e);
+                    else G->r[A][i] = v;
+                }
+                break;
+            case 2:
+                FOR_LANES(i, G->run) {
+                    uint32_t id = G->r[A][i];
+                    const char *e = lane_store(&lanes[i], id, G->r[B][i], G->r[C][i]);
+                    if (UNLIKELY(e != NULL)) group_fail(G, i, e);
+                    else if (UNLIKELY(id == 0)) group_eject(G, i, G->pc + 1); // own code now
+                }
+                break;
+            case 3: VSET(G, G->r[A], G->r[B] + G->r[C]); break;
+            case 4: VSET(G, G->r[A], G->r[B] * G->r[C]); break;
+            case 5:
+                FOR_LANES(i, G->run) {
+                    uint32_t d = G->r[C][i];
+                    if (UNLIKELY(d == 0)) group_fail(G, i, "divide by zero");
+                    else G->r[A][i] = G->r[B][i] / d;
+                }
+                break;
+            case 6: VSET(G, G->r[A], ~(G->r[B] & G->r[C])); break;
+            case 7:
+                FOR_LANES(i, G->run) {
+                    lanes[i].state = LANE_HALTED;
+                    lanes[i].pc = G->pc;
+                    group_drop(G, i);
+                }
+                break;
+            case 8:
+                FOR_LANES(i, G->run) {
+                    uint32_t id;
+                    const char *e = lane_alloc(&lanes[i], G->r[C][i], &id);
+                    if (UNLIKELY(e != NULL)) group_fail(G, i, e);
+                    else G->r[B][i] = id;
+                }
+                break;
+            case 9:
+                FOR_LANES(i, G->run) {
+                    const char *e = lane_free(&lanes[i], G->r[C][i]);
+                    if (UNLIKELY(e != NULL)) group_fail(G, i, e);
+                }
+                break;
+            case 10:
+                FOR_LANES(i, G->run) {
+                    const char *e = lane_out(&lanes[i], G->r[C][i]);
+                    if (UNLIKELY(e != NULL)) group_fail(G, i, e);
+                }
+                break;
+            case 11:
+                FOR_LANES(i, G->run) G->r[C][i] = lane_in(&lanes[i]);
+                break;
+            case 12: {
+                // jump: stay together if every enabled lane goes to the same
+                // place and nobody is waiting, else reschedule
+                int same = !G->masked;
+                uint32_t to = 0;
+                unsigned first = 1;
+                FOR_LANES(i, G->run) {
+                    uint32_t id = G->r[B][i], t = G->r[C][i];
+                    if (UNLIKELY(id != 0)) {
+                        const char *e = lane_loadprog(&lanes[i], id);
+                        if (e) group_fail(G, i, e);
+                        else group_eject(G, i, t);
+                        continue;
+                    }
+                    G->lpc[i] = t;
+                    if (first) to = t;
+                    else if (t != to) same = 0;
+                    first = 0;
+                }
+                if (same && G->run && G->run == G->live) {
+                    G->pc = to;
+                    continue;
+                }
+                more = group_schedule(G);
+                continue;
+            }
+            case 13: VSET(G, G->r[LI_A(w)], (vword){0} + LI_VAL(w)); break;
+            default:
+                FOR_LANES(i, G->run) group_fail(G, i, "invalid opcode");
+                break;
+        }
+
+        G->pc++;
+        if (UNLIKELY(G->run == 0)) {
+            more = group_schedule(G);
+        } else if (UNLIKELY((G->live & (G->live - 1)) == 0)) {
+            // every other lane has left: the survivor goes scalar
+            group_park(G);
+            more = group_schedule(G);
+        }
+    }
+
+    for (unsigned i = 0; i < n; ++i) {
+        if (lanes[i].state == LANE_SCALAR) st->scalar_insns += run_scalar(&lanes[i]);
+    }
+}
+
+/*---------------------------------- CLI ----------------------------------*/
+
+typedef struct {
+    char *name;
+    unsigned char *in;
+    size_t len;
+} Input;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static char *xstrdup(const char *s) {
+    size_t n = strlen(s) + 1;
+    return memcpy(xrealloc(NULL, n), s, n);
+}
+
+/* one instance per line of path (each keeps its '\n') */
+static Input *inputs_from_lines(const char *path, size_t *out_n) {
+    size_t len;
+    unsigned char *buf = slurp(path, &len);
+    Input *v = NULL;
+    size_t n = 0, cap = 0;
+
+    for (size_t pos = 0; pos < len;) {
+        unsigned char *nl = memchr(buf + pos, '\n', len - pos);
+        size_t end = nl ? (size_t)(nl - buf) + 1 : len;
+        if (n == cap) {
+            cap = cap ? 2 * cap : 256;
+            v = xrealloc(v, cap * sizeof *v);
+        }
+        char name[64];
+        snprintf(name, sizeof name, "line %zu", n + 1);
+        v[n].name = xstrdup(name);
+        v[n].len = end - pos;
+        v[n].in = memcpy(xrealloc(NULL, v[n].len + 1), buf + pos, v[n].len);
+        n++;
+        pos = end;
+    }
+    free(buf);
+    *out_n = n;
+    return v;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "usage: %s [--scalar | --compare] [--stats] [--lanes=K] [-o DIR]\n"
+        "       %*s <program.um> (--lines=FILE | <input>...)\n"
+        "  --scalar     run each instance alone (no lockstep)\n"
+        "  --compare    run both ways, check they agree, report times\n"
+        "  --stats      print lockstep counters to stderr\n"
+        "  --lanes=K    instances per group, 1..%d (default %d)\n"
+        "  --lines=FILE one instance per line of FILE\n"
+        "  -o DIR       write each output to DIR/<n>.out instead of stdout\n",
+        prog, (int)strlen(prog), "", BATCH_LANES, BATCH_LANES);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    int scalar = 0, compare = 0, stats = 0;
+    unsigned k = BATCH_LANES;
+    const char *lines = NULL, *outdir = NULL, *prog = NULL;
+    Input *inputs = NULL;
+    size_t ninputs = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *a = argv[i];
+        if (strcmp(a, "--scalar") == 0) scalar = 1;
+        else if (strcmp(a, "--compare") == 0) compare = 1;
+        else if (strcmp(a, "--stats") == 0) stats = 1;
+        else if (strncmp(a, "--lanes=", 8) == 0) {
+            k = (unsigned)strtoul(a + 8, NULL, 10);
+            if (k < 1 || k > BATCH_LANES) usage(argv[0]);
+        }
+        else if (strncmp(a, "--lines=", 8) == 0) lines = a + 8;
+        else if (strcmp(a, "-o") == 0 && i + 1 < argc) outdir = argv[++i];
+        else if (a[0] == '-' && a[1] == '-') usage(argv[0]);
+        else if (!prog) prog = a;
+        else {
+            if (lines) usage(argv[0]);
+            size_t len;
+            unsigned char *in = slurp(a, &len);
+            inputs = xrealloc(inputs, (ninputs + 1) * sizeof *inputs);
+            inputs[ninputs++] = (Input){ xstrdup(a), in, len };
+        }
+    }
+    if (!prog || (scalar && compare)) usage(argv[0]);
+    if (lines) {
+        if (ninputs) usage(argv[0]);
+        inputs = inputs_from_lines(lines, &ninputs);
+    }
+    if (ninputs == 0) usage(argv[0]);
+
+    load_program(prog);
+
+    BatchStats st = {0};
+    double t_group = 0, t_scalar = 0;
+    uint64_t scalar_insns = 0;
+    int status = 0;
+    Lane lanes[BATCH_LANES], ref[BATCH_LANES];
+
+    for (size_t base = 0; base < ninputs; base += k) {
+        unsigned n = ninputs - base < k ? (unsigned)(ninputs - base) : k;
+        Lane *res = lanes;
+
+        if (!scalar) {
+            for (unsigned i = 0; i < n; ++i) lane_init(&lanes[i], inputs[base + i].in, inputs[base + i].len);
+            double t0 = now_sec();
+            run_group(lanes, n, &st);
+            t_group += now_sec() - t0;
+        }
+        if (scalar || compare) {
+            Lane *s = scalar ? lanes : ref;
+            for (unsigned i = 0; i < n; ++i) lane_init(&s[i], inputs[base + i].in, inputs[base + i].len);
+            double t0 = now_sec();
+            for (unsigned i = 0; i < n; ++i) scalar_insns += run_scalar(&s[i]);
+            t_scalar += now_sec() - t0;
+        }
+
+        for (unsigned i = 0; i < n; ++i) {
+            const Input *in = &inputs[base + i];
+            Lane *L = &res[i];
+
+            if (compare && (L->state != ref[i].state || L->err != ref[i].err ||
+                            L->out_len != ref[i].out_len ||
+                            (L->out_len && memcmp(L->out, ref[i].out, L->out_len) != 0))) {
+                fprintf(stderr, "batch: %s: lockstep and scalar runs differ\n", in->name);
+                status = 1;
+            }
+            if (L->state == LANE_FAILED) {
+                fprintf(stderr, "batch: %s: %s (pc=%u)\n", in->name, L->err, (unsigned)L->pc);
+                status = 1;
+            }
+
+            if (outdir) {
+                char path[4096];
+                snprintf(path, sizeof path, "%s/%zu.out", outdir, base + i);
+                FILE *f = fopen(path, "wb");
+                if (!f || fwrite(L->out, 1, L->out_len, f) != L->out_len || fclose(f) != 0) {
+                    fprintf(stderr, "batch: cannot write %s: %s\n", path, strerror(errno));
+                    exit(1);
+                }
+            } else if (L->out_len) {
+                fwrite(L->out, 1, L->out_len, stdout);
+            }
+
+            lane_destroy(L);
+            if (compare) lane_destroy(&ref[i]);
+        }
+    }
+
+    if (stats && !scalar) {
+        uint64_t total = st.lane_insns + st.scalar_insns;
+        fprintf(stderr,
+            "batch: %zu instances, %u lanes: %llu group steps, %.1f%% lane utilization\n"
+            "batch: %llu splits, %llu lanes finished scalar (%.1f%% of instructions)\n",
+            ninputs, k, (unsigned long long)st.steps,
+            st.steps ? 100.0 * (double)st.lane_insns / ((double)st.steps * k) : 0.0,
+            (unsigned long long)st.splits, (unsigned long long)st.ejected,
+            total ? 100.0 * (double)st.scalar_insns / (double)total : 0.0);
+    }
+    if (compare) {
+        fprintf(stderr, "batch: lockstep %.3f s, scalar %.3f s (%.2fx), %llu instructions\n",
+                t_group, t_scalar, t_group > 0 ? t_scalar / t_group : 0.0,
+                (unsigned long long)scalar_insns);
+    }
+
+    for (size_t i = 0; i < ninputs; ++i) {
+        free(inputs[i].name);
+        free(inputs[i].in);
+    }
+    free(inputs);
+    free(g_prog);
+    return status;
+}
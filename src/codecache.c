@@ -0,0 +1,145 @@
+// UM persistent code cache
+// -----------------------------------------------------------------------------
+// One file per program image, DIR/<key>.umcc, holding the trace recordings
+// (block lists) the threaded engine compiled for that image. The engine replays
+// them whenever array 0 is loaded with the same image (at boot or by a
+// loadprog swap), so hot loops run as traces from their first iteration.
+//
+// What is (not) cached:
+//   - Block lists, not compiled ops: a compiled op is a handler pointer, which
+//     differs between binaries and (with ASLR) between runs. Re-linking a
+//     recording is a copy of already-decoded slots, so replaying is cheap.
+//   - Only traces whose copied words still match the image as loaded are
+//     saved (see engine.c); the key covers the whole image, so a cached trace
+//     is valid for any run that loads the same words.
+//
+// File layout (native endian; the key already ties it to this engine build):
+//   CCHeader, CCTrace[ntraces], CCBlock[nblocks]
+//
+// Validation on open: magic, version, key and word count must match, and the
+// section sizes must add up to the file size. Anything else is a miss.
+// -----------------------------------------------------------------------------
+#define _POSIX_C_SOURCE 200809L // mkstemp, fdopen
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "codecache.h"
+
+#define CC_MAGIC 0x43434D55u // "UMCC" little-endian
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version; // UM_ENGINE_VERSION
+    uint64_t key;
+    uint32_t nwords; // image length
+    uint32_t ntraces;
+    uint32_t nblocks;
+    uint32_t reserved;
+} CCHeader;
+
+/* FNV-1a over whole words (one multiply per word), 64-bit */
+static uint64_t fnv1a32(uint64_t h, const uint32_t *w, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        h ^= w[i];
+        h *= 0x100000001B3ull;
+    }
+    return h;
+}
+
+uint64_t cc_key(const uint32_t *words, size_t n) {
+    uint32_t meta[2] = { UM_ENGINE_VERSION, (uint32_t)n };
+    uint64_t h = fnv1a32(0xCBF29CE484222325ull, meta, 2);
+    return fnv1a32(h, words, n);
+}
+
+/* DIR/<16 hex digits>.umcc */
+static int cc_path(char *buf, size_t cap, const char *dir, uint64_t key) {
+    int n = snprintf(buf, cap, "%s/%016llx.umcc", dir, (unsigned long long)key);
+    return (n < 0 || (size_t)n >= cap) ? -1 : 0;
+}
+
+int cc_open(CodeCache *cc, const char *dir, uint64_t key, uint32_t nwords) {
+    char path[4096];
+    memset(cc, 0, sizeof *cc);
+    if (cc_path(path, sizeof path, dir, key) != 0) return -1;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CCHeader)) {
+        close(fd);
+        return -1;
+    }
+
+    size_t size = (size_t)st.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    const CCHeader *h = (const CCHeader*)map;
+    size_t want = sizeof *h + (size_t)h->ntraces * sizeof(CCTrace)
+                            + (size_t)h->nblocks * sizeof(CCBlock);
+    if (h->magic != CC_MAGIC || h->version != UM_ENGINE_VERSION ||
+        h->key != key || h->nwords != nwords || want != size) {
+        munmap(map, size);
+        return -1;
+    }
+
+    cc->map = map;
+    cc->size = size;
+    cc->traces = (const CCTrace*)(h + 1);
+    cc->ntraces = h->ntraces;
+    cc->blocks = (const CCBlock*)(cc->traces + h->ntraces);
+    cc->nblocks = h->nblocks;
+    return 0;
+}
+
+void cc_close(CodeCache *cc) {
+    if (cc->map) munmap(cc->map, cc->size);
+    memset(cc, 0, sizeof *cc);
+}
+
+int cc_save(const char *dir, uint64_t key, uint32_t nwords,
+            const CCTrace *traces, uint32_t ntraces,
+            const CCBlock *blocks, uint32_t nblocks) {
+    char path[4096], tmp[4096 + 16];
+    if (cc_path(path, sizeof path, dir, key) != 0) return -1;
+    snprintf(tmp, sizeof tmp, "%s.XXXXXX", path);
+
+    int fd = mkstemp(tmp);
+    if (fd < 0) return -1;
+    FILE *f = fdopen(fd, "wb");
+    if (!f) {
+        close(fd);
+        unlink(tmp);
+        return -1;
+    }
+
+    CCHeader h = {
+        .magic = CC_MAGIC,
+        .version = UM_ENGINE_VERSION,
+        .key = key,
+        .nwords = nwords,
+        .ntraces = ntraces,
+        .nblocks = nblocks,
+    };
+    int ok = fwrite(&h, sizeof h, 1, f) == 1;
+    if (ok && ntraces) ok = fwrite(traces, sizeof *traces, ntraces, f) == ntraces;
+    if (ok && nblocks) ok = fwrite(blocks, sizeof *blocks, nblocks, f) == nblocks;
+    if (fclose(f) != 0) ok = 0;
+
+    // readers either see the old file or the complete new one
+    if (!ok || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
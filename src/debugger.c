@@ -0,0 +1,174 @@
+// UM breakpoint debugger (loader --break)
+// -----------------------------------------------------------------------------
+// Debugging without a -DTRACE rebuild: breakpoints are patched into the
+// threaded engine's decoded stream (engine.c, engine_break), so a release
+// binary runs at full speed until one is hit. This file is the other half:
+// the --break list and the prompt a hit stops at.
+//
+// Commands come from the controlling terminal (/dev/tty), since stdin and
+// stdout belong to the program, or from --break-cmds=FILE (a script or a
+// FIFO). The prompt and all replies go to stderr. Numbers are decimal or 0x
+// hex:
+//   c              continue
+//   s              step one instruction
+//   b [PC]         set a breakpoint (no PC: list them)
+//   d PC           delete one
+//   r              registers
+//   set rN V       change register N
+//   x ID OFF [N]   N words (default 8) of array ID from OFF
+//   l [N]          the next N words (default 8) of array 0 as instructions
+//   q              stop the program (fails with exit status 1)
+//   h              this list
+// An empty line repeats the last c or s. End of input continues without
+// stopping again (all breakpoints are cleared).
+// -----------------------------------------------------------------------------
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "um.h"
+#include "engine.h"
+#include "debugger.h"
+#include "tracefile.h"
+
+#define DBG_LINE 256
+
+static FILE *g_dbg_in = NULL;
+static char g_dbg_last = 'c'; // repeated by an empty line
+
+/* one number (decimal or 0x hex) at *pp; 0 if there is none */
+static int dbg_num(char **pp, uint32_t *v) {
+    char *p = *pp, *end;
+    while (*p == ' ' || *p == '\t') ++p;
+    if (*p == '-') return 0;
+    errno = 0;
+    unsigned long x = strtoul(p, &end, 0);
+    if (end == p || errno || x > UINT32_MAX) return 0;
+    *pp = end;
+    *v = (uint32_t)x;
+    return 1;
+}
+
+/* line for pc as the text trace prints it (registers as of now) */
+static void dbg_show(uint32_t pc, const uint32_t *r) {
+    TraceRec e = { .kind = TR_INSN, .pc = pc, .w = g_arr[0].data[pc] };
+    memcpy(e.r, r, sizeof e.r);
+    char buf[160];
+    trace_format(buf, sizeof buf, &e);
+    fprintf(stderr, "%s\n", buf);
+}
+
+static void dbg_help(void) {
+    fprintf(stderr,
+        "c continue | s step | b [PC] set/list | d PC delete | r registers\n"
+        "set rN V | x ID OFF [N] memory | l [N] list code | q quit | h help\n");
+}
+
+int debug_open(const char *breaks, const char *cmds) {
+    const char *p = breaks;
+    while (*p) {
+        char *end;
+        errno = 0;
+        unsigned long pc = strtoul(p, &end, 0);
+        if (end == p || errno || pc > UINT32_MAX || *p == '-' || (*end && *end != ',')) {
+            fprintf(stderr, "bad --break '%s' (expected pc[,pc...])\n", breaks);
+            return -1;
+        }
+        engine_break((uint32_t)pc, 1);
+        p = *end ? end + 1 : end;
+    }
+
+    const char *path = cmds ? cmds : "/dev/tty";
+    g_dbg_in = fopen(path, "r");
+    if (!g_dbg_in) {
+        fprintf(stderr, "--break: cannot read commands from %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int debug_stop(uint32_t pc, uint32_t *r) {
+    fflush(stdout); // program output so far, before the stop
+    fprintf(stderr, "stop: ");
+    dbg_show(pc, r);
+
+    char line[DBG_LINE];
+    for (;;) {
+        fprintf(stderr, "(um) ");
+        if (!fgets(line, sizeof line, g_dbg_in)) {
+            // no more commands: run to the end
+            const uint32_t *pcs;
+            while (engine_breaks(&pcs)) engine_break(pcs[0], 0);
+            fprintf(stderr, "\n");
+            return 0;
+        }
+        char *p = line;
+        while (*p == ' ' || *p == '\t') ++p;
+        char cmd = (*p == '\n' || !*p) ? g_dbg_last : *p;
+        if (strncmp(p, "set", 3) == 0) cmd = '=';
+        char *arg = p;
+        while (*arg && *arg != ' ' && *arg != '\t' && *arg != '\n') ++arg;
+        uint32_t a, b, n;
+
+        switch (cmd) {
+        case 'c':
+        case 's':
+            g_dbg_last = cmd;
+            return cmd == 's';
+        case 'b':
+            if (dbg_num(&arg, &a)) {
+                engine_break(a, 1);
+            } else {
+                const uint32_t *pcs;
+                size_t nb = engine_breaks(&pcs);
+                for (size_t i = 0; i < nb; ++i) fprintf(stderr, "break at pc=%u\n", pcs[i]);
+                if (!nb) fprintf(stderr, "no breakpoints\n");
+            }
+            break;
+        case 'd':
+            if (!dbg_num(&arg, &a)) fprintf(stderr, "usage: d PC\n");
+            else if (!engine_break(a, 0)) fprintf(stderr, "no breakpoint at pc=%u\n", a);
+            break;
+        case 'r':
+            for (int i = 0; i < 8; ++i) {
+                fprintf(stderr, "r%d=%u (0x%08x)%s", i, r[i], r[i], i % 4 == 3 ? "\n" : "  ");
+            }
+            break;
+        case 'x':
+            if (!dbg_num(&arg, &a) || !dbg_num(&arg, &b)) {
+                fprintf(stderr, "usage: x ID OFF [N]\n");
+                break;
+            }
+            if (!dbg_num(&arg, &n)) n = 8;
+            if (a >= g_arr_len || !g_arr[a].active) {
+                fprintf(stderr, "no array %u\n", a);
+                break;
+            }
+            for (uint32_t k = 0; k < n && (size_t)b + k < g_arr[a].len; ++k) {
+                fprintf(stderr, "mem[%u][%u] = 0x%08x (%u)\n", a, b + k, g_arr[a].data[b + k],
+                        g_arr[a].data[b + k]);
+            }
+            break;
+        case 'l':
+            if (!dbg_num(&arg, &n)) n = 8;
+            for (uint32_t k = 0; k < n && (size_t)pc + k < g_arr[0].len; ++k) dbg_show(pc + k, r);
+            break;
+        case 'q':
+            fail_and_exit("stopped in the debugger");
+        case '=':
+            while (*arg == ' ' || *arg == '\t') ++arg;
+            if (*arg == 'r') ++arg;
+            if (dbg_num(&arg, &a) && a < 8 && dbg_num(&arg, &b)) r[a] = b;
+            else fprintf(stderr, "usage: set rN V\n");
+            break;
+        case 'h':
+        case '?':
+            dbg_help();
+            break;
+        default:
+            fprintf(stderr, "unknown command (h for help)\n");
+            break;
+        }
+    }
+}
@@ -0,0 +1,1956 @@
+// UM threaded engine
+// -----------------------------------------------------------------------------
+// Runs the program in array 0 from a pre-decoded stream instead of decoding
+// every word inside a switch.
+//
+// Pre-decoded stream:
+//   - g_code[pc] holds one UMOp per word of array 0: a handler pointer plus
+//     the loadimm immediate. Each handler returns or tail-calls the next op
+//     (see NEXT); halt returns NULL to engine_run.
+//   - Slot g_code[len] is the trap handler for running off the end (it mirrors
+//     the sentinel word after array 0), so no per-cycle pc check is needed.
+//
+// Operand-specialized handlers:
+//   - Every ABC op gets one handler per (A, B, C) combination, generated by
+//     the UM_EACH_* macros below, so regs[A]/regs[B]/regs[C] are constant
+//     offsets. The low 9 bits of an ABC word (A<<6 | B<<3 | C) index the
+//     op's 512-entry table directly.
+//   - alloc/loadprog are specialized on (B, C), dealloc/out/in on C and
+//     loadimm on A.
+//   - Common nand/add sequences (AND, b + ~c, subtraction) decode to one
+//     fused handler in their first slot (see idiom_at).
+//
+// Streaming load (--stream): g_code covers what the loader thread has read so
+// far and ends in h_wait instead of the trap slot. Falling into it or jumping
+// past it waits in stream_wait and decodes what arrived.
+//
+// Decoding uses umc_sel (umc.h); a program loaded from a .umc hands its
+// stored selector table to the first decode_all.
+//
+// Self-modifying code:
+//   - aupd into array 0 re-decodes the written slot in place (h_aupdcode);
+//     a slot flagged in g_slot (traced, fused, breakpoint, recording hook)
+//     goes through code_written instead. A running trace carries on unless
+//     some trace copied that word.
+//   - loadprog with B != 0 re-decodes the whole stream.
+//
+// Watchpoints (--watch): aupd decodes to one generic handler that checks the
+// watched range, so the check costs nothing unless a watch is set.
+//
+// Breakpoints (--break, src/debugger.c): a breakpoint's slot gets the trap
+// handler h_break in place of its own, so only hit breakpoints cost anything.
+//
+// Trace optimizer (trace_opt): a value-range pass over each compiled trace
+// swaps in check-free div, out, aidx and aupd handlers where it can prove the
+// checks pass, and a multiply for div by a constant.
+//
+// Loop bounds hoisting (trace_hoist): a loop trace that indexes arrays held in
+// registers it never writes checks them once on entry, then runs a check-free
+// copy of its body for as many iterations as that check covers.
+//
+// Branch lowering (trace_branches): a cmov picking between two loadimm
+// targets followed by `loadprog 0` becomes one two-way branch in the trace,
+// whose other side enters the trace at that target directly.
+//
+// Return stack (--ret-stack, trace_calls; off by default): traced calls push
+// their return address and traced returns pop it, entering the trace there
+// when the recorded target misses. Measured no faster (README).
+//
+// Code cache (--code-cache=DIR, src/codecache.c):
+//   - Traces are saved per program image (the boot image and each image a
+//     loadprog swaps in) and replayed when a later run loads the same image.
+//
+// All engine state is per thread (UM_TLS): --pipe runs one VM per thread.
+// -----------------------------------------------------------------------------
+#define _POSIX_C_SOURCE 200809L // putchar_unlocked, getchar_unlocked
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "um.h"
+#include "engine.h"
+#include "codecache.h"
+#include "umc.h"
+#include "ring.h"
+#include "debugger.h"
+#include "reclaim.h"
+#include "zero.h"
+
+typedef struct UMOp UMOp;
+typedef const UMOp *(*UMHandler)(const UMOp *ip, uint32_t *r);
+
+struct UMOp {
+    UMHandler fn; // specialized handler
+    uint32_t imm; // loadimm value / guard target / trace index / jumps so far (loadprogjit)
+};
+
+static UM_TLS UMOp *g_code = NULL; // decoded array 0, g_code_len + 1 slots
+static UM_TLS size_t g_code_len = 0; // mirrors g_arr[0].len (decoded part while streaming)
+static UM_TLS size_t g_code_cap = 0; // allocated slots
+static UM_TLS unsigned char *g_slot = NULL; // per slot: UM_SLOT_* flags
+static UM_TLS uint32_t *g_hits = NULL; // per slot: counted jumps to it (jump_hot)
+
+/* slots that an aupd into array 0 may not just re-decode (code_written) */
+#define UM_SLOT_TRACED 1u // copied into some trace
+#define UM_SLOT_FUSED 2u // inside a fused idiom, past its first word
+#define UM_SLOT_BREAK 4u // breakpoint (h_break)
+#define UM_SLOT_HOOK 8u // end of the block being recorded (rec_hook)
+
+static UM_TLS int g_jit = 1; // record and run hot-path traces
+static UM_TLS int g_ret_stack = 0; // --ret-stack: trace_calls marks calls and returns
+
+/* shadow return stack (--ret-stack): return addresses pushed by traced
+   calls, popped by traced returns; it only predicts, so it wraps */
+#define UM_RS_DEPTH 64u
+static UM_TLS uint32_t g_rs[UM_RS_DEPTH];
+static UM_TLS uint32_t g_rsp;
+
+#define UM_HOT_JUMPS 64u // jumps to one target before recording starts there
+#define UM_RETRY_JUMPS 65536u // extra jumps before an aborted head is retried
+#define UM_SITE_JUMPS 4096u // counted jumps from one loadprog before it stops counting
+#define UM_TRACE_MAX_BLOCKS 64u // jumps per trace
+#define UM_TRACE_MAX_OPS 4096u // ops per trace
+
+static ALWAYS_INLINE UMOp decode(uint32_t w);
+static ALWAYS_INLINE UMOp decode_sel(uint16_t sel, uint32_t w);
+static const UMOp *h_pc_oob(const UMOp *ip, uint32_t *r);
+static const UMOp *h_wait(const UMOp *ip, uint32_t *r);
+static void traces_flush(void);
+static void rec_start(uint32_t head);
+static void rec_abort(void);
+static const UMOp *code_written(const UMOp *ip, uint32_t off);
+static uint32_t op_pc(const UMOp *ip);
+static const UMOp *h_break(const UMOp *ip, uint32_t *r);
+static const UMOp *h_enter(const UMOp *ip, uint32_t *r);
+static const UMOp *trace_ops(uint32_t i);
+static void bps_apply(size_t lo, size_t hi);
+static void bp_sync(uint32_t pc);
+static void cache_keep(void);
+static void cache_image(void);
+static void idioms_fuse(size_t lo, size_t hi);
+
+/* fused nand idioms (idiom_at) */
+enum { UM_ID_AND, UM_ID_NOTADD, UM_ID_SUB, UM_ID_KINDS };
+
+/* what the decoder and trace compiler did, for --stats */
+static UM_TLS struct {
+    uint64_t idioms[UM_ID_KINDS]; // sites fused, per kind
+    uint64_t nots; // `nand x y y` on its own (one host op already)
+    uint64_t traces, hoisted; // traces compiled; loop traces with an entry check
+    uint64_t checkfree; // trace ops whose checks were dropped
+    uint64_t branches; // cmov-and-jump pairs lowered to two-way branches
+    uint64_t divk; // divs by a constant turned into a multiply
+    uint64_t calls; // trace calls and returns marked for the return stack
+} g_stats;
+
+static UM_TLS int g_fuse = 1; // fuse idioms while decoding (off under --break)
+
+static UM_TLS struct {
+    int active; // a path is being recorded
+    uint32_t head; // pc the trace will start at
+    uint32_t cur; // start pc of the block currently executing
+    uint32_t hook; // where that block ends (rec_hook)
+    UMHandler hook_fn; // that slot's own handler; NULL: nothing hooked
+} g_rec;
+
+/*------------------------------ shared op bodies -----------------------------*/
+
+/* 1: A <- mem[B][C] */
+static ALWAYS_INLINE uint32_t arr_load(uint32_t id, uint32_t off) {
+    if (UNLIKELY(id >= g_arr_len || !g_arr[id].active)) fail_and_exit("index: inactive array");
+    if (UNLIKELY((size_t)off >= g_arr[id].len) && !stream_reach(id, off)) fail_and_exit("index: offset OOB");
+    return g_arr[id].data[off];
+}
+
+/* 2: mem[A][B] <- C; a write into array 0 re-decodes that slot */
+static ALWAYS_INLINE const UMOp *arr_store(const UMOp *ip, uint32_t id, uint32_t off, uint32_t val) {
+    if (UNLIKELY(id >= g_arr_len || !g_arr[id].active)) fail_and_exit("update: inactive array");
+    if (UNLIKELY((size_t)off >= g_arr[id].len) && !stream_reach(id, off)) fail_and_exit("update: offset OOB");
+    g_arr[id].data[off] = val;
+    if (UNLIKELY(id == 0)) return code_written(ip, off);
+    return ip + 1;
+}
+
+/* divisors that traces divide by with a multiply (see trace_opt): per
+   divisor d >= 2, m = ceil(2^64 / d), for which n / d == (n * m) >> 64
+   for every 32-bit n. Entries depend only on d, so they are never dropped. */
+#define UM_DIVK_MAX 256u
+
+static UM_TLS uint64_t g_divk[UM_DIVK_MAX]; // m
+static UM_TLS uint32_t g_divk_d[UM_DIVK_MAX]; // d
+static UM_TLS uint32_t g_ndivk = 0;
+
+/* (n * m) >> 64 from two 32x32 -> 64-bit multiplies */
+static ALWAYS_INLINE uint32_t div_magic(uint64_t m, uint32_t n) {
+    uint64_t lo = (m & 0xFFFFFFFFu) * n;
+    return (uint32_t)(((m >> 32) * n + (lo >> 32)) >> 32);
+}
+
+/* 5: unsigned division, /0 = Fail */
+static ALWAYS_INLINE uint32_t div_checked(uint32_t num, uint32_t denom) {
+    if (UNLIKELY(denom == 0)) fail_and_exit("divide by zero");
+    return num / denom;
+}
+
+/* 8: zeroed array of n words; returns its nonzero id */
+static uint32_t do_alloc(uint32_t n) {
+    uint32_t *data = NULL;
+
+    if (n > 0) {
+        data = (uint32_t*)zero_alloc((size_t)n);
+        if (!data) fail_and_exit("alloc: OOM");
+    }
+
+    uint32_t id = id_acquire();
+    if (id == 0) fail_and_exit("alloc: id 0 reserved");
+
+    g_arr[id].data = data;
+    g_arr[id].len = n;
+    g_arr[id].active = 1;
+    return id;
+}
+
+/* 9: free array id (not 0, must be active) */
+static void do_dealloc(uint32_t id) {
+    if (id == 0 || id >= g_arr_len || !g_arr[id].active) {
+        fail_and_exit("dealloc: invalid or inactive id");
+    }
+
+    reclaim_free(g_arr[id].data, g_arr[id].len * sizeof(uint32_t));
+    g_arr[id].data = NULL;
+    g_arr[id].len = 0;
+    g_arr[id].active = 0;
+    id_release(id);
+}
+
+/* 10: print one byte (0..255), pass it to the next --pipe stage, or drop
+   or hash it (--output) */
+static ALWAYS_INLINE void do_out_byte(uint32_t v) {
+    if (UNLIKELY(g_out_ring != NULL)) {
+        if (ring_put(g_out_ring, (unsigned char)v) != 0) pipe_broken();
+    } else if (UNLIKELY(g_out_mode != UM_OUT_STDOUT)) {
+        if (g_out_mode == UM_OUT_HASH) g_out_hash = UM_HASH_STEP(g_out_hash, v);
+    } else {
+        putchar_unlocked((int)v); // only this thread uses stdout (see g_in_ring)
+    }
+}
+
+static ALWAYS_INLINE void do_out(uint32_t v) {
+    if (UNLIKELY(v > 255u)) fail_and_exit("output: value > 255");
+    do_out_byte(v);
+}
+
+/* 11: one byte of input (stdin or the previous stage), EOF -> 0xFFFFFFFF */
+static ALWAYS_INLINE uint32_t do_in(void) {
+    int ch = UNLIKELY(g_in_ring != NULL) ? ring_get(g_in_ring) : getchar_unlocked();
+    return ch == EOF ? 0xFFFFFFFFu : (uint32_t)(unsigned char)ch;
+}
+
+/* end the decoded stream at g_code_len: the trap slot, or h_wait while the
+   loader thread still has words to deliver */
+static void code_seal(void) {
+    g_code[g_code_len].fn = g_stream_len ? h_wait : h_pc_oob; // h_pc_oob mirrors the sentinel
+    g_code[g_code_len].imm = 0;
+}
+
+/* (re)build g_code from array 0, using its operand selectors if given.
+   While streaming only the loaded prefix is decoded (see stream_decode). */
+static void decode_all(const uint16_t *sel) {
+    size_t n = g_stream_len ? g_stream_len : g_arr[0].len;
+    size_t ready = g_arr[0].len;
+
+    if (n + 1 > g_code_cap) {
+        UMOp *nc = (UMOp*)realloc(g_code, (n + 1) * sizeof(UMOp));
+        if (!nc) fail_and_exit("loadprog: OOM");
+        g_code = nc;
+        unsigned char *ns = (unsigned char*)realloc(g_slot, n + 1);
+        if (!ns) fail_and_exit("loadprog: OOM");
+        g_slot = ns;
+        uint32_t *nh = (uint32_t*)realloc(g_hits, (n + 1) * sizeof(uint32_t));
+        if (!nh) fail_and_exit("loadprog: OOM");
+        g_hits = nh;
+        g_code_cap = n + 1;
+    }
+    memset(g_slot, 0, n + 1);
+    memset(g_hits, 0, (n + 1) * sizeof(uint32_t));
+
+    const uint32_t *words = g_arr[0].data;
+    if (sel) {
+        for (size_t i = 0; i < ready; ++i) g_code[i] = decode_sel(sel[i], words[i]);
+    } else {
+        for (size_t i = 0; i < ready; ++i) g_code[i] = decode(words[i]);
+    }
+    g_code_len = ready;
+    idioms_fuse(0, ready);
+    bps_apply(0, ready);
+    code_seal();
+}
+
+/* --stream: wait until pc is loaded (or the load is complete) and decode
+   everything that has arrived since */
+static void stream_decode(size_t pc) {
+    size_t len = stream_wait(pc);
+    const uint32_t *words = g_arr[0].data;
+    for (size_t i = g_code_len; i < len; ++i) g_code[i] = decode(words[i]);
+    size_t lo = g_code_len;
+    g_code_len = len;
+    idioms_fuse(lo, len); // (an idiom cut by a chunk end stays plain)
+    bps_apply(lo, len);
+    code_seal();
+}
+
+/* 12 with B != 0: duplicate mem[id] into array 0 and re-decode */
+static void load_program(uint32_t id) {
+    if (id >= g_arr_len || !g_arr[id].active) fail_and_exit("loadprog: inactive id");
+
+    size_t n = g_arr[id].len;
+    uint32_t *dup = (uint32_t*)malloc((n + 1) * sizeof(uint32_t));
+
+    if (!dup) fail_and_exit("loadprog: OOM");
+    if (n > 0) memcpy(dup, g_arr[id].data, n * sizeof(uint32_t));
+    dup[n] = UM_SENTINEL;
+
+    traces_flush();
+    program_replace(dup, n);
+    decode_all(NULL);
+    cache_image();
+}
+
+/* 12: pc = C (after the optional program swap) */
+static ALWAYS_INLINE const UMOp *do_jump(uint32_t id, uint32_t target) {
+    if (id != 0) load_program(id); // also flushes traces and recording
+    // target == len lands on the trap slot; anything past it has no slot
+    // (or, while streaming, may not be decoded yet)
+    if (UNLIKELY((size_t)target > g_code_len)) {
+        if (g_stream_len) stream_decode(target);
+        if ((size_t)target > g_code_len) fail_and_exit("PC out of bounds at cycle start");
+    }
+    return g_code + target;
+}
+
+/* 12 where traces start and end (loadprogjit, a guard that missed, the other
+   side of a lowered branch): straight into the trace at the target if there
+   is one, else count the jump and start recording there once it is hot */
+static NOINLINE const UMOp *jump_hot(uint32_t id, uint32_t target) {
+    // a recorded block only leaves through its hook, unless it was rewritten
+    if (UNLIKELY(g_rec.active)) rec_abort();
+    const UMOp *t = do_jump(id, target);
+    if (t->fn == h_enter) return trace_ops(t->imm);
+    if (UNLIKELY(++g_hits[target] == UM_HOT_JUMPS)) rec_start(target);
+    return t;
+}
+
+static const UMOp *site_jump(const UMOp *ip, unsigned bc, uint32_t id, uint32_t target);
+
+/*---------------------------- handler generation -----------------------------*/
+
+/* R8_n(M, args...) expands M(args..., 0) .. M(args..., 7); one copy per
+   nesting level because a macro cannot expand inside itself */
+#define UM_R8_1(M, ...) \
+    M(__VA_ARGS__, 0) M(__VA_ARGS__, 1) M(__VA_ARGS__, 2) M(__VA_ARGS__, 3) \
+    M(__VA_ARGS__, 4) M(__VA_ARGS__, 5) M(__VA_ARGS__, 6) M(__VA_ARGS__, 7)
+#define UM_R8_2(M, ...) \
+    M(__VA_ARGS__, 0) M(__VA_ARGS__, 1) M(__VA_ARGS__, 2) M(__VA_ARGS__, 3) \
+    M(__VA_ARGS__, 4) M(__VA_ARGS__, 5) M(__VA_ARGS__, 6) M(__VA_ARGS__, 7)
+#define UM_R8_3(M, ...) \
+    M(__VA_ARGS__, 0) M(__VA_ARGS__, 1) M(__VA_ARGS__, 2) M(__VA_ARGS__, 3) \
+    M(__VA_ARGS__, 4) M(__VA_ARGS__, 5) M(__VA_ARGS__, 6) M(__VA_ARGS__, 7)
+
+/* M(op, c), M(op, b, c) and M(op, a, b, c) over every register combination,
+   in table order (index = a<<6 | b<<3 | c) */
+#define UM_EACH_C(M, op)            UM_R8_1(M, op)
+#define UM_EACH_BC_1(M, op, b)      UM_R8_1(M, op, b)
+#define UM_EACH_BC(M, op)           UM_R8_2(UM_EACH_BC_1, M, op)
+#define UM_EACH_ABC_1(M, op, a, b)  UM_R8_1(M, op, a, b)
+#define UM_EACH_ABC_2(M, op, a)     UM_R8_2(UM_EACH_ABC_1, M, op, a)
+#define UM_EACH_ABC(M, op)          UM_R8_3(UM_EACH_ABC_2, M, op)
+
+/* never inlined: a slow twin (SLOW) inlined into its fast handler would
+   bring its stack frame along */
+#define HANDLER(name) static NOINLINE const UMOp *name(const UMOp *ip, uint32_t *r)
+
+/* NEXT(ip): continue at ip. With guaranteed tail calls every handler jumps
+   straight into the next one (one indirect branch per handler, which the
+   predictor tracks separately); otherwise it returns to engine_run's loop.
+   GCC before 15 has no musttail but turns these into sibling calls from -O2
+   up, so the unoptimized debug build keeps the loop. */
+#if !defined(UM_NO_TAILCALL) && defined(__has_attribute)
+# if __has_attribute(musttail)
+#  define UM_MUSTTAIL __attribute__((musttail))
+#  define UM_TAILCALL 1
+# endif
+#endif
+#if !defined(UM_NO_TAILCALL) && !defined(UM_TAILCALL) && defined(__GNUC__) && defined(__OPTIMIZE__)
+# define UM_MUSTTAIL
+# define UM_TAILCALL 1
+#endif
+
+#ifdef UM_TAILCALL
+# define NEXT(nip) do { const UMOp *next_ = (nip); UM_MUSTTAIL return next_->fn(next_, r); } while (0)
+# define SLOW(h) do { UM_MUSTTAIL return h(ip, r); } while (0)
+#else
+# define NEXT(nip) return (nip)
+# define SLOW(h) return h(ip, r)
+#endif
+
+/* SLOW(h): hand the op to h, its slow twin. aidx, aupd and loadprog only do
+   their common case inline; streaming, faults, rewriting code and program
+   swaps call back into the engine, and a call would cost every run of the
+   handler a stack frame (callee-saved registers pushed and popped). */
+
+/* op bodies, with register numbers as literal constants. An inactive array
+   has length 0, so a length check covers it. */
+#define BODY_cmov(A, B, C) if (r[C] != 0) r[A] = r[B]; NEXT(ip + 1);
+#define BODY_aidx(A, B, C) \
+    uint32_t id_ = r[B], off_ = r[C]; \
+    if (UNLIKELY(id_ >= g_arr_len || off_ >= g_arr[id_].len)) SLOW(h_aidxslow_##A##B##C); \
+    r[A] = g_arr[id_].data[off_]; \
+    NEXT(ip + 1);
+/* a write into array 0 re-decodes that slot (aupdcode) */
+#define BODY_aupd(A, B, C) \
+    uint32_t id_ = r[A], off_ = r[B]; \
+    if (UNLIKELY(id_ >= g_arr_len || off_ >= g_arr[id_].len)) SLOW(h_aupdslow_##A##B##C); \
+    if (id_ == 0) SLOW(h_aupdcode_##A##B##C); \
+    g_arr[id_].data[off_] = r[C]; \
+    NEXT(ip + 1);
+/* aupd into array 0, in bounds: decode the word into its slot, unless the
+   slot is flagged in g_slot (or not decoded yet while streaming); then
+   code_written sorts it out */
+#define BODY_aupdcode(A, B, C) \
+    uint32_t off_ = r[B], v_ = r[C]; \
+    if (UNLIKELY(off_ >= g_code_len || g_slot[off_] != 0)) SLOW(h_aupdslow_##A##B##C); \
+    g_code[off_] = decode(v_); \
+    g_arr[0].data[off_] = v_; \
+    NEXT(ip + 1);
+#define BODY_aidxslow(A, B, C) r[A] = arr_load(r[B], r[C]); NEXT(ip + 1);
+#define BODY_aupdslow(A, B, C) NEXT(arr_store(ip, r[A], r[B], r[C]));
+#define BODY_add(A, B, C)  r[A] = r[B] + r[C]; NEXT(ip + 1);
+#define BODY_mul(A, B, C)  r[A] = r[B] * r[C]; NEXT(ip + 1);
+#define BODY_div(A, B, C)  r[A] = div_checked(r[B], r[C]); NEXT(ip + 1);
+#define BODY_nand(A, B, C) r[A] = ~(r[B] & r[C]); NEXT(ip + 1);
+
+#define DEF_ABC(op, a, b, c) HANDLER(h_##op##_##a##b##c) { BODY_##op(a, b, c) }
+#define REF_ABC(op, a, b, c) h_##op##_##a##b##c,
+#define DEF_BC(op, b, c) HANDLER(h_##op##_##b##c) { BODY_##op(b, c) }
+#define REF_BC(op, b, c) h_##op##_##b##c,
+#define DEF_C(op, c) HANDLER(h_##op##_##c) { BODY_##op(c) }
+#define REF_C(op, c) h_##op##_##c,
+
+#define BODY_alloc(B, C)    r[B] = do_alloc(r[C]); NEXT(ip + 1);
+#define BODY_loadprog(B, C) \
+    if (UNLIKELY(r[B] != 0 || r[C] > g_code_len)) SLOW(h_loadprogslow_##B##C); \
+    NEXT(g_code + r[C]);
+#define BODY_loadprogslow(B, C) (void)ip; NEXT(do_jump(r[B], r[C]));
+/* loadprog while the JIT is on: counts its jumps (site_jump) until it turns
+   into the plain one */
+#define BODY_loadprogjit(B, C) NEXT(site_jump(ip, B << 3 | C, r[B], r[C]));
+#define BODY_dealloc(C)     do_dealloc(r[C]); NEXT(ip + 1);
+#define BODY_out(C)         do_out(r[C]); NEXT(ip + 1);
+#define BODY_in(C)          r[C] = do_in(); NEXT(ip + 1);
+#define BODY_loadimm(A)     r[A] = ip->imm; NEXT(ip + 1);
+
+/* trace-only variants of div, aidx, aupd and out whose checks the trace
+   optimizer proved redundant (see trace_opt) */
+#define BODY_divnz(A, B, C)  r[A] = r[B] / r[C]; NEXT(ip + 1);
+#define BODY_aidxnc(A, B, C) r[A] = g_arr[r[B]].data[r[C]]; NEXT(ip + 1);
+#define BODY_aupdnc(A, B, C) g_arr[r[A]].data[r[B]] = r[C]; NEXT(ip + 1);
+#define BODY_outnc(C)        do_out_byte(r[C]); NEXT(ip + 1);
+
+/* div by the constant in C as a multiply (imm indexes g_divk) */
+#define BODY_divk(A, B, C) r[A] = div_magic(g_divk[ip->imm], r[B]); NEXT(ip + 1);
+
+/* fused nand idioms (see idiom_at); ip->imm holds the scratch register t
+   (sub: t | one << 3), which ends up as in the original sequence */
+#define BODY_and(A, B, C) \
+    uint32_t x_ = ~(r[B] & r[C]); /* nand t B C; nand A t t */ \
+    r[ip->imm] = x_; \
+    r[A] = ~x_; \
+    NEXT(ip + 2);
+#define BODY_notadd(A, B, C) \
+    uint32_t x_ = ~r[C]; /* nand t C C; add A t B */ \
+    r[ip->imm] = x_; \
+    r[A] = r[B] + x_; \
+    NEXT(ip + 2);
+#define BODY_sub(A, B, C) \
+    uint32_t *t_ = &r[ip->imm & 7u]; /* nand t C C; add t t one; add A t B */ \
+    *t_ = ~r[C]; \
+    *t_ += r[ip->imm >> 3]; \
+    r[A] = r[B] + *t_; \
+    NEXT(ip + 3);
+
+/* trace guard for a recorded `loadprog B C`: stay in the trace while it
+   is still a plain jump to the recorded target, else take the real jump */
+#define BODY_guard(B, C) \
+    if (r[B] == 0 && r[C] == ip->imm) NEXT(ip + 1); \
+    SLOW(h_guardmiss_##B##C);
+/* a guard that missed: from one trace into the next without a call when
+   the jump goes to a trace head, else a counted jump */
+#define BODY_guardmiss(B, C) \
+    uint32_t t_ = r[C]; \
+    if (r[B] == 0 && t_ <= g_code_len && g_code[t_].fn == h_enter) NEXT(trace_ops(g_code[t_].imm)); \
+    SLOW(h_guardjump_##B##C);
+#define BODY_guardjump(B, C) (void)ip; NEXT(jump_hot(r[B], r[C]));
+
+/* --ret-stack (trace_calls): the loadimm of a call's return address pushes
+   it, and the guard of a return pops it. A return that misses its recorded
+   target but goes where the stack said enters the trace there directly. */
+#define BODY_loadimmpush(A) \
+    r[A] = ip->imm; \
+    g_rs[g_rsp++ & (UM_RS_DEPTH - 1)] = ip->imm; \
+    NEXT(ip + 1);
+#define BODY_ret(B, C) \
+    uint32_t p_ = g_rs[--g_rsp & (UM_RS_DEPTH - 1)]; \
+    if (r[B] == 0 && r[C] == ip->imm) NEXT(ip + 1); \
+    if (r[B] == 0 && r[C] == p_ && p_ <= g_code_len && g_code[p_].fn == h_enter) NEXT(trace_ops(g_code[p_].imm)); \
+    SLOW(h_guardjump_##B##C);
+
+/* lowered two-way branch (see trace_branches): `cmov A B C` and the guard
+   of the `loadprog z A` after it, with A and B holding the two targets.
+   imm = z | dir << 3, where dir is the recorded side (1: r[C] != 0); the
+   other side goes to the exit op in the guard's slot. */
+#define BODY_branch(A, B, C) \
+    uint32_t c_ = r[C], z_ = ip->imm & 7u; \
+    if (c_ != 0) r[A] = r[B]; \
+    if (r[z_] == 0 && (c_ != 0) == (ip->imm >> 3)) NEXT(ip + 2); \
+    if (UNLIKELY(r[z_] != 0)) SLOW(h_branchswap_##A##B##C); \
+    NEXT(ip + 1);
+#define BODY_branchswap(A, B, C) NEXT(jump_hot(r[ip->imm & 7u], r[A]));
+
+UM_EACH_ABC(DEF_ABC, cmov)
+UM_EACH_ABC(DEF_ABC, aidxslow)
+UM_EACH_ABC(DEF_ABC, aidx)
+UM_EACH_ABC(DEF_ABC, aupdslow)
+UM_EACH_ABC(DEF_ABC, aupdcode)
+UM_EACH_ABC(DEF_ABC, aupd)
+UM_EACH_ABC(DEF_ABC, add)
+UM_EACH_ABC(DEF_ABC, mul)
+UM_EACH_ABC(DEF_ABC, div)
+UM_EACH_ABC(DEF_ABC, nand)
+UM_EACH_BC(DEF_BC, alloc)
+UM_EACH_BC(DEF_BC, loadprogslow)
+UM_EACH_BC(DEF_BC, loadprog)
+UM_EACH_BC(DEF_BC, loadprogjit)
+UM_EACH_BC(DEF_BC, guardjump)
+UM_EACH_BC(DEF_BC, guardmiss)
+UM_EACH_BC(DEF_BC, guard)
+UM_EACH_BC(DEF_BC, ret)
+UM_EACH_ABC(DEF_ABC, divnz)
+UM_EACH_ABC(DEF_ABC, divk)
+UM_EACH_ABC(DEF_ABC, aidxnc)
+UM_EACH_ABC(DEF_ABC, aupdnc)
+UM_EACH_C(DEF_C, outnc)
+UM_EACH_ABC(DEF_ABC, and)
+UM_EACH_ABC(DEF_ABC, notadd)
+UM_EACH_ABC(DEF_ABC, sub)
+UM_EACH_ABC(DEF_ABC, branchswap)
+UM_EACH_ABC(DEF_ABC, branch)
+UM_EACH_C(DEF_C, dealloc)
+UM_EACH_C(DEF_C, out)
+UM_EACH_C(DEF_C, in)
+UM_EACH_C(DEF_C, loadimm)
+UM_EACH_C(DEF_C, loadimmpush)
+
+/* 7: halt ends the dispatch loop */
+HANDLER(h_halt) {
+    (void)ip; (void)r;
+    return NULL;
+}
+
+/* 14/15: not UM opcodes */
+HANDLER(h_invalid) {
+    (void)ip; (void)r;
+    fail_and_exit("invalid opcode");
+}
+
+/* slot g_code[len] while streaming: wait for more words, decode, rerun */
+HANDLER(h_wait) {
+    (void)r;
+    stream_decode((size_t)(ip - g_code));
+    NEXT(ip);
+}
+
+/* slot g_code[len]: execution ran off the end of array 0 */
+HANDLER(h_pc_oob) {
+    (void)ip; (void)r;
+    fail_and_exit("PC out of bounds at cycle start");
+}
+
+/* 2 under --watch: every aupd decodes to this one generic handler (A, B, C
+   in imm) so the specialized ones stay free of the check */
+HANDLER(h_aupd_watch) {
+    uint32_t id = r[(ip->imm >> 6) & 7u], off = r[(ip->imm >> 3) & 7u], val = r[ip->imm & 7u];
+    if (UNLIKELY(watch_covers(id, off)) && id < g_arr_len && g_arr[id].active && off < g_arr[id].len) {
+        watch_hit(op_pc(ip), id, off, g_arr[id].data[off], val);
+    }
+    NEXT(arr_store(ip, id, off, val));
+}
+
+static const UMHandler t_cmov[512] = { UM_EACH_ABC(REF_ABC, cmov) };
+static const UMHandler t_aidx[512] = { UM_EACH_ABC(REF_ABC, aidx) };
+static const UMHandler t_aupd[512] = { UM_EACH_ABC(REF_ABC, aupd) };
+static const UMHandler t_add[512]  = { UM_EACH_ABC(REF_ABC, add) };
+static const UMHandler t_mul[512]  = { UM_EACH_ABC(REF_ABC, mul) };
+static const UMHandler t_div[512]  = { UM_EACH_ABC(REF_ABC, div) };
+static const UMHandler t_nand[512] = { UM_EACH_ABC(REF_ABC, nand) };
+static const UMHandler t_alloc[64]    = { UM_EACH_BC(REF_BC, alloc) };
+static const UMHandler t_loadprog[64] = { UM_EACH_BC(REF_BC, loadprog) };
+static const UMHandler t_loadprogjit[64] = { UM_EACH_BC(REF_BC, loadprogjit) };
+static const UMHandler t_guard[64]    = { UM_EACH_BC(REF_BC, guard) };
+static const UMHandler t_ret[64]      = { UM_EACH_BC(REF_BC, ret) };
+static const UMHandler t_dealloc[8] = { UM_EACH_C(REF_C, dealloc) };
+static const UMHandler t_out[8]     = { UM_EACH_C(REF_C, out) };
+static const UMHandler t_in[8]      = { UM_EACH_C(REF_C, in) };
+static const UMHandler t_loadimm[8] = { UM_EACH_C(REF_C, loadimm) };
+static const UMHandler t_loadimm_push[8] = { UM_EACH_C(REF_C, loadimmpush) };
+static const UMHandler t_div_nz[512]  = { UM_EACH_ABC(REF_ABC, divnz) };
+static const UMHandler t_div_k[512]   = { UM_EACH_ABC(REF_ABC, divk) };
+static const UMHandler t_aidx_nc[512] = { UM_EACH_ABC(REF_ABC, aidxnc) };
+static const UMHandler t_aupd_nc[512] = { UM_EACH_ABC(REF_ABC, aupdnc) };
+static const UMHandler t_out_nc[8]    = { UM_EACH_C(REF_C, outnc) };
+static const UMHandler t_and[512]    = { UM_EACH_ABC(REF_ABC, and) };
+static const UMHandler t_notadd[512] = { UM_EACH_ABC(REF_ABC, notadd) };
+static const UMHandler t_sub[512]    = { UM_EACH_ABC(REF_ABC, sub) };
+static const UMHandler t_branch[512] = { UM_EACH_ABC(REF_ABC, branch) };
+
+/*---------------------------------- decoder ----------------------------------*/
+
+static const UMHandler t_halt[1]    = { h_halt };
+static const UMHandler t_invalid[1] = { h_invalid };
+static const UMHandler t_watch[1]   = { h_aupd_watch };
+
+/* per op: its handler table for this run, and the operand bits that index
+   it (umc_sel_mask; dec_init) */
+static UM_TLS const UMHandler *g_dec[16];
+static UM_TLS uint16_t g_dec_mask[16];
+
+/* per op: the bits of the word its imm keeps (loadimm: the value; aupd: its
+   operands, for h_aupd_watch) */
+static const uint32_t k_imm_mask[16] = { 0, 0, 0x1FF, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x1FFFFFF, 0, 0 };
+
+static void dec_init(void) {
+    static const UMHandler *const dec[16] = {
+        t_cmov, t_aidx, t_aupd, t_add, t_mul, t_div, t_nand, t_halt,
+        t_alloc, t_dealloc, t_out, t_in, t_loadprog, t_loadimm, t_invalid, t_invalid,
+    };
+    memcpy(g_dec, dec, sizeof dec);
+    memcpy(g_dec_mask, umc_sel_mask, sizeof g_dec_mask);
+    if (g_jit) g_dec[12] = t_loadprogjit;
+    if (g_watch.on) { // one generic handler (operands in imm)
+        g_dec[2] = t_watch;
+        g_dec_mask[2] = 0;
+    }
+}
+
+/* the op for word w, whose table index bits are k. Table lookups instead
+   of a switch: aupd into array 0 decodes inline, often data words.
+   Indexes are masked to each table's size, so no selector reads past one. */
+static ALWAYS_INLINE UMOp decode_op(unsigned op, unsigned k, uint32_t w) {
+    UMOp o = { g_dec[op][k & g_dec_mask[op]], w & k_imm_mask[op] };
+    return o;
+}
+
+/* pick the specialized handler for word w from its operand selector
+   (umc_sel(w): op << 9 | the operand bits that index the op's table) */
+static ALWAYS_INLINE UMOp decode_sel(uint16_t sel, uint32_t w) {
+    return decode_op(sel >> 9 & 15u, sel & 0x1FFu, w); // a .umc's selectors are not checked
+}
+
+/* pick the specialized handler for one word */
+static ALWAYS_INLINE UMOp decode(uint32_t w) {
+    unsigned op = OPC(w);
+    return decode_op(op, op == 13 ? LI_A(w) : w & 0x1FFu, w);
+}
+
+/* loadprogjit at ip (B << 3 | C = bc): jump_hot, counting the jumps from
+   this slot in its imm, where one into a trace counts UM_HOT_JUMPS. Past
+   UM_SITE_JUMPS the slot becomes a plain loadprog: by then its targets are
+   traces, or not hot. Jumps out of traces keep counting (jump_hot). */
+static const UMOp *site_jump(const UMOp *ip, unsigned bc, uint32_t id, uint32_t target) {
+    UMOp *site = g_code + (ip - g_code);
+    const UMOp *t = jump_hot(id, target);
+
+    // after a swap the slot is gone; a breakpoint's slot keeps h_break
+    if (id == 0 && site->fn == t_loadprogjit[bc]) {
+        site->imm += t == g_code + target ? 1u : UM_HOT_JUMPS;
+        if (site->imm >= UM_SITE_JUMPS) site->fn = t_loadprog[bc];
+    }
+    return t;
+}
+
+/*--------------------------------- nand idioms -------------------------------*/
+// UM has only nand and add, so compiled code spells AND, NOT and subtraction
+// as short sequences. Decoding fuses the common ones into one handler that
+// runs the whole sequence and skips past it:
+//   and:    nand t B C ; nand A t t              A = B & C
+//   notadd: nand t C C ; add A t B (or B t)      A = B + ~C
+//   sub:    nand t C C ; add t t one ; add A t B A = B + ~C + one (B - C when
+//                                                one holds 1, as by convention)
+// t keeps its intermediate value, so every register ends up as if the words
+// ran one by one. Only the first slot changes; the others keep their own ops
+// for jumps into the middle. A write to any word of an idiom un-fuses it
+// (code_written; g_slot flags the words past the first). A fused op runs
+// over any trace head inside it, so recorded blocks never end inside one
+// and traces copy fused ops as they are. A flush fuses trace heads again.
+// Breakpoints turn fusion off.
+
+/* the idiom starting at pc (entirely below end): its length, with the
+   fused op in *op and its kind in *kind; 0 if there is none */
+static unsigned idiom_at(const uint32_t *words, size_t pc, size_t end, UMOp *op, unsigned *kind) {
+    uint32_t w0 = words[pc];
+    if (OPC(w0) != 6 || pc + 1 >= end) return 0;
+    unsigned t = ABC_A(w0), p = ABC_B(w0), q = ABC_C(w0);
+    uint32_t w1 = words[pc + 1];
+
+    if (p == q && OPC(w1) == 3 && (ABC_B(w1) == t || ABC_C(w1) == t)) {
+        unsigned other = ABC_B(w1) == t ? ABC_C(w1) : ABC_B(w1);
+        uint32_t w2 = pc + 2 < end ? words[pc + 2] : 0; // 0: a cmov, never matches
+        if (ABC_A(w1) == t && OPC(w2) == 3 && (ABC_B(w2) == t || ABC_C(w2) == t)) {
+            unsigned x = ABC_B(w2) == t ? ABC_C(w2) : ABC_B(w2);
+            op->fn = t_sub[ABC_A(w2) << 6 | x << 3 | p];
+            op->imm = t | other << 3;
+            *kind = UM_ID_SUB;
+            return 3;
+        }
+        op->fn = t_notadd[ABC_A(w1) << 6 | other << 3 | p];
+        op->imm = t;
+        *kind = UM_ID_NOTADD;
+        return 2;
+    }
+    if (OPC(w1) == 6 && ABC_B(w1) == t && ABC_C(w1) == t) {
+        op->fn = t_and[ABC_A(w1) << 6 | p << 3 | q];
+        op->imm = t;
+        *kind = UM_ID_AND;
+        return 2;
+    }
+    return 0;
+}
+
+/* fuse the idioms starting in freshly decoded slots lo..hi-1 */
+static void idioms_fuse(size_t lo, size_t hi) {
+    const uint32_t *words = g_arr[0].data;
+    UMOp op;
+    unsigned kind;
+
+    if (!g_fuse) return;
+    for (size_t pc = lo; pc < hi; ++pc) {
+        unsigned n = idiom_at(words, pc, g_code_len, &op, &kind);
+        if (n) {
+            g_code[pc] = op;
+            for (unsigned j = 1; j < n; ++j) g_slot[pc + j] |= UM_SLOT_FUSED;
+            g_stats.idioms[kind]++;
+            pc += n - 1;
+        } else if (OPC(words[pc]) == 6 && ABC_B(words[pc]) == ABC_C(words[pc])) {
+            g_stats.nots++;
+        }
+    }
+}
+
+static const UMOp *h_rec_fall(const UMOp *ip, uint32_t *r);
+
+/* g_code[pc] holds a fused idiom */
+static int is_fused(uint32_t pc) {
+    uint32_t w = g_arr[0].data[pc];
+    const UMHandler fn = g_code[pc].fn;
+    return OPC(w) == 6 && fn != t_nand[w & 0x1FFu] && fn != h_enter && fn != h_break && fn != h_rec_fall;
+}
+
+/*------------------------------- trace compiler ------------------------------*/
+// Hot-path traces (a tracing JIT whose "native code" is a linear run of the
+// same specialized handlers; there is no machine-code backend):
+//   - Only some jumps count: while the JIT is on, loadprog decodes to
+//     loadprogjit, and traces leave through guards and branch exits. Those
+//     bump a hit count on the target (g_hits, jump_hot); at UM_HOT_JUMPS
+//     recording starts with that target as the trace head. A loadprogjit
+//     slot becomes a plain loadprog after UM_SITE_JUMPS counted jumps, so
+//     hot code left in g_code jumps as it does without the JIT.
+//   - Recording hooks only where the running block ends: rec_hook patches
+//     its loadprog (or the trace head it falls into) with h_rec_jump (or
+//     h_rec_fall), which records the block and hooks the next one. Between
+//     two jumps execution is straight line, so the path is a list of blocks
+//     (start pc, jump pc, target).
+//   - Recording ends when a jump returns to the head (loop trace), or when
+//     a jump or plain fallthrough reaches another trace's head (linked
+//     trace). Swapping the program, rewriting a traced word or an overlong
+//     path aborts it.
+//   - The compiled trace copies the blocks' decoded ops into one buffer and
+//     turns each jump into a guard: while the jump is still `loadprog 0` to
+//     the recorded target execution stays in the buffer, otherwise the
+//     guard exits to g_code through the normal jump path.
+//   - The head slot in g_code is patched to h_enter, so fallthrough into
+//     the head, and jumps to it, run the trace. Counted jumps (jump_hot) go
+//     straight to the trace's ops, and a trace ending at another one's head
+//     links to it (h_trace_link).
+//   - A write into array 0 at a pc some trace copied (UM_SLOT_TRACED) and
+//     any program swap flush all traces; writes elsewhere only re-decode.
+//   - Trace ops keep their source pcs in a side array (UMTrace.pcs), not
+//     in UMOp, for the passes below and the rare paths that need a pc.
+
+typedef struct {
+    uint32_t start; // first pc of the block
+    uint32_t jump; // pc of the loadprog ending it (or of the head it fell into)
+    uint32_t target; // where that jump went
+    int guard; // 0: the block fell through into another trace's head
+} UMBlock;
+
+/* entry check of a loop trace with hoisted bounds checks (see trace_hoist) */
+enum { UM_HV_ADDK, UM_HV_ADDREG, UM_HV_INDEX };
+
+typedef struct {
+    uint8_t kind; // UM_HV_*: induction += k, += r[reg], or indexes array r[reg]
+    uint8_t reg;
+    uint32_t k;
+} UMHoistEv;
+
+typedef struct {
+    uint8_t arrs; // registers holding the loop's arrays (bit per register)
+    uint8_t wrt; // of those, arrays the loop writes (must not be array 0)
+    uint8_t iarrs; // of those, arrays indexed by the induction register
+    uint8_t ind; // the induction register
+    uint32_t cmax[8]; // per array register: largest bounded offset + 1
+    UMHoistEv *ev; // induction events of one iteration, in order
+    uint32_t nev;
+    uint32_t slow; // distance from ops[0] to the checked copy
+    uint32_t misses; // failed entry checks in a row
+} UMHoist;
+
+typedef struct {
+    UMOp *ops; // compiled ops
+    uint32_t *pcs; // per op: the pc it was copied from
+    uint32_t nops;
+    uint32_t head; // entry pc (g_code[head] is h_enter)
+    UMHoist hoist; // when ops[0] is h_hoist
+} UMTrace;
+
+static UM_TLS UMTrace *g_traces = NULL;
+static UM_TLS size_t g_ntraces = 0;
+static UM_TLS size_t g_traces_cap = 0;
+
+/* first op of trace i */
+static const UMOp *trace_ops(uint32_t i) {
+    return g_traces[i].ops;
+}
+
+static UM_TLS UMBlock g_rec_blocks[UM_TRACE_MAX_BLOCKS];
+static UM_TLS size_t g_rec_nblocks = 0;
+static UM_TLS size_t g_rec_nops = 0; // ops the trace would need so far
+
+/* give the hooked slot its own handler back */
+static void rec_unhook(void) {
+    if (!g_rec.hook_fn) return;
+    g_code[g_rec.hook].fn = g_rec.hook_fn;
+    g_slot[g_rec.hook] &= (unsigned char)~UM_SLOT_HOOK;
+    g_rec.hook_fn = NULL;
+}
+
+/* stop recording; the head waits UM_RETRY_JUMPS more jumps before retrying */
+static void rec_abort(void) {
+    if (!g_rec.active) return;
+    rec_unhook();
+    g_rec.active = 0;
+    g_hits[g_rec.head] = 0u - UM_RETRY_JUMPS;
+}
+
+static void rec_jump(uint32_t jpc, uint32_t target);
+static void rec_fall(uint32_t pc);
+static const UMOp *h_rec_jump(const UMOp *ip, uint32_t *r);
+
+/* main-stream slot that a trace enters through */
+HANDLER(h_enter) {
+    (void)r;
+    NEXT(g_traces[ip->imm].ops);
+}
+
+/* end of a loop trace: back to its first op (imm = distance) */
+HANDLER(h_trace_loop) {
+    (void)r;
+    NEXT(ip - ip->imm);
+}
+
+/* end of a linked trace: continue at g_code[imm] (another trace's head) */
+HANDLER(h_trace_goto) {
+    (void)r;
+    NEXT(g_code + ip->imm);
+}
+
+/* end of a linked trace whose target trace already exists: straight into
+   it (imm = its index; traces are only ever flushed all together) */
+HANDLER(h_trace_link) {
+    (void)r;
+    NEXT(g_traces[ip->imm].ops);
+}
+
+/* recording: patch the slot where the block from g_rec.cur ends, its
+   loadprog or the trace head it falls into, so that the block reports its
+   end (h_rec_jump / h_rec_fall) and nothing else pays for recording. A
+   block that halts, faults, stops at a breakpoint or runs past the decoded
+   code or the trace size is not recorded. */
+static void rec_hook(void) {
+    const uint32_t *words = g_arr[0].data;
+    uint32_t pc = g_rec.cur;
+    UMOp op;
+    unsigned kind;
+
+    while (pc < g_code_len && g_rec_nops + (pc - g_rec.cur) < UM_TRACE_MAX_OPS) {
+        UMHandler fn = g_code[pc].fn;
+        unsigned opc = OPC(words[pc]);
+        if (fn == h_enter || (opc == 12 && fn != h_break)) {
+            g_rec.hook = pc;
+            g_rec.hook_fn = fn;
+            g_code[pc].fn = fn == h_enter ? h_rec_fall : h_rec_jump;
+            g_slot[pc] |= UM_SLOT_HOOK;
+            return;
+        }
+        if (opc == 12 || opc == 7 || opc >= 14) break;
+        unsigned len = is_fused(pc) ? idiom_at(words, pc, g_code_len, &op, &kind) : 0;
+        pc += len ? len : 1;
+    }
+    rec_abort();
+}
+
+static void rec_start(uint32_t head) {
+    // busy, already a trace head or a breakpoint: count again from zero
+    if (!g_jit || g_rec.active || g_code[head].fn == h_enter || g_code[head].fn == h_break) {
+        g_hits[head] = 0;
+        return;
+    }
+    g_rec.active = 1;
+    g_rec.head = head;
+    g_rec.cur = head;
+    g_rec_nblocks = 0;
+    g_rec_nops = 0;
+    rec_hook();
+}
+
+/* recording: the running block's loadprog. Take the jump, record the
+   block, hook the next one. */
+HANDLER(h_rec_jump) {
+    uint32_t pc = (uint32_t)(ip - g_code), w = g_arr[0].data[pc];
+    uint32_t target = r[ABC_C(w)];
+
+    rec_unhook();
+    const UMOp *t = do_jump(r[ABC_B(w)], target); // a swap aborts the recording
+    if (g_rec.active) rec_jump(pc, target); // may compile a trace starting at t
+    NEXT(t);
+}
+
+/* recording: the running block fell into the trace head in this slot */
+HANDLER(h_rec_fall) {
+    (void)r;
+    rec_unhook();
+    rec_fall((uint32_t)(ip - g_code));
+    NEXT(ip);
+}
+
+/*------------------------------ trace optimizer ------------------------------*/
+// A trace is only ever entered at its first op (h_enter, h_trace_loop), so
+// facts proven along it from there hold for every later op in the same pass.
+// (In g_code any pc may be a computed jump target, so nothing is proven.)
+//
+// trace_opt walks the compiled ops once, keeping per register an interval
+// [lo, hi] and whether it holds an array allocated earlier in the trace (and
+// its length). Every register starts unknown. Guards that stay in the trace
+// fix their registers (B = 0, C = the target), and a checked op that did not
+// fail refines its operands (div: divisor >= 1, out: value <= 255). With
+// that, check-free variants replace:
+//   - div by a constant >= 2 (a loadimm, typically): a multiply by its
+//     reciprocal (div_magic),
+//   - other div whose divisor is >= 1,
+//   - out whose value is <= 255,
+//   - aidx/aupd on an array allocated in the trace, or aidx on array 0,
+//     at an offset below its length.
+// A dealloc forgets all arrays, and a breakpoint (which may change registers
+// from the debugger) forgets everything.
+
+typedef struct {
+    uint32_t lo, hi; // value range
+    uint32_t arr; // 1: an array allocated in this trace (still live)
+    uint32_t len; // its length
+} UMRange;
+
+static const UMRange k_unknown = { 0, UINT32_MAX, 0, 0 };
+
+static UMRange rv_const(uint32_t v) {
+    UMRange x = { v, v, 0, 0 };
+    return x;
+}
+
+static UMRange rv_span(uint64_t lo, uint64_t hi) {
+    if (hi > UINT32_MAX) return k_unknown;
+    UMRange x = { (uint32_t)lo, (uint32_t)hi, 0, 0 };
+    return x;
+}
+
+/* either of two values (cmov with an unknown condition) */
+static UMRange rv_join(UMRange a, UMRange b) {
+    UMRange x = { a.lo < b.lo ? a.lo : b.lo, a.hi > b.hi ? a.hi : b.hi, 0, 0 };
+    if (a.arr && b.arr && a.len == b.len) {
+        x.arr = 1;
+        x.len = a.len;
+    }
+    return x;
+}
+
+/* offset range rc is inside the array whose id has range rb */
+static int rv_in_bounds(UMRange rb, UMRange rc) {
+    if (rb.arr) return rc.hi < rb.len;
+    return rb.hi == 0 && (size_t)rc.hi < g_arr[0].len; // array 0 (only a swap shrinks it, which flushes)
+}
+
+/* g_divk index for divisor d >= 2, adding it if new; -1 if the table is full */
+static int divk_index(uint32_t d) {
+    for (uint32_t i = 0; i < g_ndivk; ++i) {
+        if (g_divk_d[i] == d) return (int)i;
+    }
+    if (g_ndivk == UM_DIVK_MAX) return -1;
+    g_divk_d[g_ndivk] = d;
+    g_divk[g_ndivk] = UINT64_MAX / d + 1; // ceil(2^64 / d)
+    return (int)g_ndivk++;
+}
+
+/* one op (copied from word w): update the ranges past it and swap in a
+   check-free variant where they prove the check passes */
+static void rv_step(UMRange *v, UMOp *op, uint32_t w) {
+    unsigned a = ABC_A(w), b = ABC_B(w), c = ABC_C(w), abc = w & 0x1FFu;
+
+    if (op->fn == h_break) {
+        for (int i = 0; i < 8; ++i) v[i] = k_unknown;
+        return;
+    }
+    switch (OPC(w)) {
+    case 0: // cmov
+        if (v[c].lo > 0) v[a] = v[b];
+        else if (v[c].hi != 0) v[a] = rv_join(v[a], v[b]);
+        break;
+    case 1: // aidx
+        if (rv_in_bounds(v[b], v[c])) op->fn = t_aidx_nc[abc];
+        v[a] = k_unknown;
+        break;
+    case 2: // aupd (into an array of the trace: never array 0, never watched)
+        if (v[a].arr && v[b].hi < v[a].len && op->fn == t_aupd[abc]) op->fn = t_aupd_nc[abc];
+        break;
+    case 3: // add
+        if (v[b].lo == v[b].hi && v[c].lo == v[c].hi) v[a] = rv_const(v[b].lo + v[c].lo);
+        else v[a] = rv_span((uint64_t)v[b].lo + v[c].lo, (uint64_t)v[b].hi + v[c].hi);
+        break;
+    case 4: // mul
+        if (v[b].lo == v[b].hi && v[c].lo == v[c].hi) v[a] = rv_const(v[b].lo * v[c].lo);
+        else v[a] = rv_span((uint64_t)v[b].lo * v[c].lo, (uint64_t)v[b].hi * v[c].hi);
+        break;
+    case 5: { // div
+        int k = v[c].lo == v[c].hi && v[c].lo >= 2 ? divk_index(v[c].lo) : -1;
+        if (v[c].hi == 0) break; // always fails
+        if (k >= 0) {
+            op->fn = t_div_k[abc];
+            op->imm = (uint32_t)k;
+        } else if (v[c].lo > 0) {
+            op->fn = t_div_nz[abc];
+        } else {
+            v[c].lo = 1; // past a checked div, the divisor was not 0
+        }
+        v[a] = rv_span(v[b].lo / v[c].hi, v[b].hi / v[c].lo);
+        break;
+    }
+    case 6: // nand
+        if (v[b].lo == v[b].hi && v[c].lo == v[c].hi) v[a] = rv_const(~(v[b].lo & v[c].lo));
+        else if (b == c) v[a] = rv_span(~v[b].hi, ~v[b].lo); // not: order-reversing
+        else v[a] = k_unknown;
+        break;
+    case 8: { // alloc
+        UMRange x = { 1, UINT32_MAX, v[c].lo == v[c].hi, v[c].lo };
+        v[b] = x;
+        break;
+    }
+    case 9: // dealloc: any register may hold the freed id
+        for (int i = 0; i < 8; ++i) v[i].arr = 0;
+        break;
+    case 10: // out
+        if (v[c].hi <= 255u) op->fn = t_out_nc[c];
+        else if (v[c].lo > 255u) break; // always fails
+        else v[c].hi = 255u;
+        break;
+    case 11: // in
+        v[c] = k_unknown;
+        break;
+    case 12: // guard: staying in the trace means B = 0 and C = the target
+        v[b] = rv_const(0);
+        v[c] = rv_const(op->imm);
+        break;
+    case 13: // loadimm
+        v[LI_A(w)] = rv_const(LI_VAL(w));
+        break;
+    default:
+        break;
+    }
+}
+
+static void trace_opt(UMOp *ops, const uint32_t *pcs, size_t n) {
+    UMRange v[8];
+    for (int i = 0; i < 8; ++i) v[i] = k_unknown;
+    for (size_t k = 0; k + 1 < n; ++k) { // the last op is the loop/goto tail
+        UMHandler fn = ops[k].fn;
+        uint32_t w = g_arr[0].data[pcs[k]];
+        rv_step(v, &ops[k], w);
+        g_stats.checkfree += ops[k].fn != fn;
+        g_stats.divk += ops[k].fn != fn && ops[k].fn == t_div_k[w & 0x1FFu];
+    }
+}
+
+/*--------------------------- loop bounds hoisting ----------------------------*/
+// A loop trace that indexes arrays held in registers it never writes checks
+// them once, on entry, instead of at every aidx/aupd of every iteration:
+//   - an offset whose range trace_opt bounds (a loadimm constant, typically
+//     a frame slot) only needs the array to be at least that long;
+//   - an offset in the induction register, which the loop changes only by
+//     adding constants or registers it never writes (`add i i r1`), is
+//     tracked as a list of events (add, access). The entry check replays the
+//     list against the live registers, which gives each array's offsets on
+//     the first iteration and the change per iteration, and from those the
+//     number of iterations that keep every offset inside its array.
+// The compiled trace then holds two copies of the body:
+//   ops[0]              h_hoist: the entry check
+//   ops[1 .. k]         the body with those accesses check-free
+//   ops[k + 1]          h_hoist_loop: next iteration while the budget lasts,
+//                       else back to the check
+//   ops[k + 2 .. 2k+1]  the body as trace_opt left it
+//   ops[2k + 2]         h_trace_loop back to ops[k + 2]
+// A failed check (an inactive array, too short, array 0 for a write, or an
+// induction offset already out of range) runs the checked copy, which loops
+// on itself until the trace is entered again. A dealloc or breakpoint in the
+// body turns hoisting off for that trace.
+
+#define UM_HOIST_MAX_MISSES 64u // failed entry checks in a row before a trace stops checking
+
+static UM_TLS uint32_t g_hoist_left = 0; // iterations left on the running fast copy
+
+/* the register an op writes, or -1 */
+static int op_dest(uint32_t w) {
+    switch (OPC(w)) {
+    case 0: case 1: case 3: case 4: case 5: case 6: return (int)ABC_A(w);
+    case 8: return (int)ABC_B(w);
+    case 11: return (int)ABC_C(w);
+    case 13: return (int)LI_A(w);
+    default: return -1;
+    }
+}
+
+/* the register an `add d d s` / `add d s d` adds to d, or -1 */
+static int op_addself(uint32_t w, int d) {
+    if (OPC(w) != 3) return -1;
+    int b = (int)ABC_B(w), c = (int)ABC_C(w);
+    if (b == d && c != d) return c;
+    if (c == d && b != d) return b;
+    return -1;
+}
+
+/* a checked aidx/aupd at op: 1 with its array and offset registers */
+static int op_access(const UMOp *op, uint32_t w, unsigned *x, unsigned *o) {
+    unsigned abc = w & 0x1FFu;
+    if (OPC(w) == 1 && op->fn == t_aidx[abc]) {
+        *x = ABC_B(w);
+        *o = ABC_C(w);
+        return 1;
+    }
+    if (OPC(w) == 2 && op->fn == t_aupd[abc]) { // not watched
+        *x = ABC_A(w);
+        *o = ABC_B(w);
+        return 1;
+    }
+    return 0;
+}
+
+/* fill h and switch the hoistable accesses of body[0..k) (copied from
+   pcs[0..k)) to check-free variants; 0 if there are none */
+static int trace_hoist(UMOp *body, const uint32_t *pcs, size_t k, UMHoist *h) {
+    UMRange v[8];
+    unsigned x, o;
+    unsigned wr = 0, adds = 0; // registers written other than / only by self-adds
+    unsigned need[8] = { 0 }; // registers added to each that must stay unchanged
+
+    for (int i = 0; i < 8; ++i) v[i] = k_unknown;
+    for (size_t j = 0; j < k; ++j) {
+        uint32_t w = g_arr[0].data[pcs[j]];
+        if (body[j].fn == h_break || OPC(w) == 9) return 0;
+        int d = op_dest(w), s = d >= 0 ? op_addself(w, d) : -1;
+        if (s >= 0) {
+            adds |= 1u << d;
+            if (v[s].lo != v[s].hi) need[d] |= 1u << s;
+        } else if (d >= 0) {
+            wr |= 1u << d;
+        }
+        UMOp t = body[j];
+        rv_step(v, &t, w);
+    }
+    unsigned fixed = ~(wr | adds) & 0xFFu; // registers the body never writes
+    unsigned ind_ok = fixed;
+    for (int i = 0; i < 8; ++i) {
+        if ((adds >> i & 1) && !(wr >> i & 1) && (need[i] & ~fixed) == 0) ind_ok |= 1u << i;
+    }
+
+    // pick the induction register indexing the most accesses
+    unsigned cnt[8] = { 0 };
+    for (int i = 0; i < 8; ++i) v[i] = k_unknown;
+    for (size_t j = 0; j < k; ++j) {
+        uint32_t w = g_arr[0].data[pcs[j]];
+        if (op_access(&body[j], w, &x, &o) && (fixed >> x & 1) && v[o].hi == UINT32_MAX && (ind_ok >> o & 1)) {
+            cnt[o]++;
+        }
+        UMOp t = body[j];
+        rv_step(v, &t, w);
+    }
+    unsigned ind = 0;
+    for (unsigned i = 1; i < 8; ++i) {
+        if (cnt[i] > cnt[ind]) ind = i;
+    }
+
+    memset(h, 0, sizeof *h);
+    h->ind = (uint8_t)ind;
+    if (cnt[ind]) {
+        h->ev = (UMHoistEv*)malloc(k * sizeof(UMHoistEv));
+        if (!h->ev) return 0;
+    }
+    for (int i = 0; i < 8; ++i) v[i] = k_unknown;
+    for (size_t j = 0; j < k; ++j) {
+        uint32_t w = g_arr[0].data[pcs[j]];
+        if (op_access(&body[j], w, &x, &o) && (fixed >> x & 1)) {
+            unsigned abc = w & 0x1FFu;
+            int hoisted = 1;
+            if (v[o].hi != UINT32_MAX) { // bounded offset
+                if (v[o].hi + 1 > h->cmax[x]) h->cmax[x] = v[o].hi + 1;
+            } else if (o == ind && cnt[ind]) {
+                UMHoistEv e = { UM_HV_INDEX, (uint8_t)x, 0 };
+                h->ev[h->nev++] = e;
+                h->iarrs |= (uint8_t)(1u << x);
+            } else {
+                hoisted = 0;
+            }
+            if (hoisted) {
+                h->arrs |= (uint8_t)(1u << x);
+                if (OPC(w) == 2) h->wrt |= (uint8_t)(1u << x);
+                body[j].fn = OPC(w) == 1 ? t_aidx_nc[abc] : t_aupd_nc[abc];
+                g_stats.checkfree++;
+            }
+        }
+        int s = op_dest(w) == (int)ind && cnt[ind] ? op_addself(w, (int)ind) : -1;
+        if (s >= 0) {
+            UMHoistEv e = { UM_HV_ADDREG, (uint8_t)s, 0 };
+            if (v[s].lo == v[s].hi) {
+                e.kind = UM_HV_ADDK;
+                e.k = v[s].lo;
+            }
+            h->ev[h->nev++] = e;
+        }
+        UMOp t = body[j];
+        rv_step(v, &t, w);
+    }
+    if (!h->arrs) {
+        free(h->ev);
+        h->ev = NULL;
+    }
+    return h->arrs != 0;
+}
+
+/* entry of a trace whose check keeps failing: straight to the checked copy */
+HANDLER(h_hoist_off) {
+    (void)r;
+    NEXT(ip + g_traces[ip->imm].hoist.slow);
+}
+
+/* a failed entry check; after UM_HOIST_MAX_MISSES in a row (say, a loop that
+   writes through a register that holds 0) the trace skips the check */
+static const UMOp *hoist_miss(const UMOp *ip, UMHoist *h) {
+    if (++h->misses == UM_HOIST_MAX_MISSES) g_traces[ip->imm].ops[0].fn = h_hoist_off;
+    return ip + h->slow;
+}
+
+/* entry of a loop trace with hoisted checks (imm = trace index) */
+HANDLER(h_hoist) {
+    UMHoist *h = &g_traces[ip->imm].hoist;
+    int64_t dmin[8], dmax[8], d = 0; // induction offsets from its value at the head
+    uint64_t left = UINT32_MAX;
+
+    for (int x = 0; x < 8; ++x) {
+        dmin[x] = INT64_MAX;
+        dmax[x] = INT64_MIN;
+    }
+    for (uint32_t e = 0; e < h->nev; ++e) {
+        const UMHoistEv *ev = &h->ev[e];
+        if (ev->kind == UM_HV_ADDK) {
+            d += (int32_t)ev->k;
+        } else if (ev->kind == UM_HV_ADDREG) {
+            d += (int32_t)r[ev->reg];
+        } else {
+            if (d < dmin[ev->reg]) dmin[ev->reg] = d;
+            if (d > dmax[ev->reg]) dmax[ev->reg] = d;
+        }
+    }
+
+    for (unsigned x = 0; x < 8; ++x) {
+        if (!(h->arrs >> x & 1)) continue;
+        uint32_t id = r[x];
+        if (id >= g_arr_len || !g_arr[id].active || (id == 0 && (h->wrt >> x & 1))) NEXT(hoist_miss(ip, h));
+        int64_t len = (int64_t)g_arr[id].len;
+        if (h->cmax[x] > len) NEXT(hoist_miss(ip, h));
+        if (!(h->iarrs >> x & 1)) continue;
+
+        int64_t lo = (int64_t)r[h->ind] + dmin[x], hi = (int64_t)r[h->ind] + dmax[x];
+        if (lo < 0 || hi >= len) NEXT(hoist_miss(ip, h));
+        // iterations until the offsets leave [0, len)
+        uint64_t it = d > 0 ? (uint64_t)(len - 1 - hi) / (uint64_t)d + 1
+                    : d < 0 ? (uint64_t)lo / (uint64_t)-d + 1 : UINT32_MAX;
+        if (it < left) left = it;
+    }
+    h->misses = 0;
+    g_hoist_left = (uint32_t)left;
+    NEXT(ip + 1);
+}
+
+/* end of the fast copy (imm = body length) */
+HANDLER(h_hoist_loop) {
+    (void)r;
+    if (--g_hoist_left) NEXT(ip - ip->imm);
+    NEXT(ip - ip->imm - 1);
+}
+
+/*------------------------------ branch lowering ------------------------------*/
+// Compiled code branches by loading both targets and letting cmov pick one:
+//   loadimm x T1 ; loadimm y T2 ; cmov x y c ; loadprog z x
+// In a trace that is a cmov and a guard comparing the computed target with
+// the recorded one. trace_branches replaces the pair with one two-way branch
+// on r[c] (h_branch_*), with both successors resolved at compile time:
+//   - the recorded side stays in the trace, past the guard's slot;
+//   - the other side goes to h_branch_exit in the guard's slot, which takes
+//     a counted jump (jump_hot) until there is a trace at that target, and
+//     then turns into a link to it (h_trace_link).
+// x and y still get their values. A nonzero r[z] (a program swap) takes the
+// real jump. The pass runs last, on the final ops: the range passes above
+// read a guard's imm as its recorded target.
+
+/* other side of a lowered branch (imm = its target) while there is no
+   trace there: a counted jump */
+HANDLER(h_branch_jump) {
+    (void)r;
+    NEXT(jump_hot(0, ip->imm));
+}
+
+/* other side of a lowered branch: once its target is a trace head, the
+   exit turns into a link to that trace (trace ops are writable, and
+   traces are only ever flushed all together) */
+HANDLER(h_branch_exit) {
+    uint32_t target = ip->imm;
+    if (target <= g_code_len && g_code[target].fn == h_enter) {
+        UMOp *x = (UMOp*)ip;
+        x->fn = h_trace_link;
+        x->imm = g_code[target].imm;
+        NEXT(x);
+    }
+    SLOW(h_branch_jump);
+}
+
+/* lower the cmov/guard pairs of body[0..k) (copied from pcs[0..k));
+   returns how many */
+static unsigned trace_branches(UMOp *body, const uint32_t *pcs, size_t k) {
+    unsigned n = 0;
+    for (size_t j = 3; j < k; ++j) {
+        uint32_t wg = g_arr[0].data[pcs[j]], wc = g_arr[0].data[pcs[j - 1]];
+        if (OPC(wg) != 12 || body[j].fn != t_guard[wg & 0x3Fu]) continue;
+        if (OPC(wc) != 0 || body[j - 1].fn != t_cmov[wc & 0x1FFu]) continue;
+        unsigned x = ABC_A(wc), y = ABC_B(wc);
+        if (ABC_C(wg) != x || x == y) continue;
+
+        // the two loadimms right before it, in either order
+        uint32_t tx = 0, ty = 0;
+        unsigned set = 0;
+        for (size_t i = j - 3; i < j - 1; ++i) {
+            uint32_t w = g_arr[0].data[pcs[i]];
+            if (OPC(w) != 13 || body[i].fn != t_loadimm[LI_A(w)]) break;
+            if (LI_A(w) == x) {
+                tx = LI_VAL(w);
+                set |= 1;
+            } else if (LI_A(w) == y) {
+                ty = LI_VAL(w);
+                set |= 2;
+            }
+        }
+        uint32_t rec = body[j].imm;
+        if (set != 3 || tx == ty || (rec != tx && rec != ty)) continue;
+
+        body[j - 1].fn = t_branch[wc & 0x1FFu];
+        body[j - 1].imm = ABC_B(wg) | (uint32_t)(rec == ty) << 3;
+        body[j].fn = h_branch_exit;
+        body[j].imm = rec == ty ? tx : ty;
+        n++;
+    }
+    return n;
+}
+
+/* --ret-stack: mark the calls and returns of body[0..k) (copied from
+   pcs[0..k)). A call is a guard after an aupd that stored a loadimm
+   constant equal to the guard's pc + 1, the return address in the frame;
+   that loadimm pushes. A return is a guard whose target register was last
+   set by an aidx; it pops. Returns how many ops were marked. */
+static unsigned trace_calls(UMOp *body, const uint32_t *pcs, size_t k) {
+    size_t li[8] = {0}; // per register in known: the loadimm that set it
+    unsigned known = 0, loaded = 0; // register masks: set by a loadimm, by an aidx
+    size_t stored = SIZE_MAX; // the loadimm whose value the last aupd stored
+    unsigned n = 0;
+    for (size_t j = 0; j < k; ++j) {
+        uint32_t w = g_arr[0].data[pcs[j]];
+        if (OPC(w) == 2 && (known >> ABC_C(w) & 1u)) stored = li[ABC_C(w)];
+        if (OPC(w) == 12 && body[j].fn == t_guard[w & 0x3Fu]) {
+            uint32_t wl = stored != SIZE_MAX ? g_arr[0].data[pcs[stored]] : 0;
+            if (stored != SIZE_MAX && LI_VAL(wl) == pcs[j] + 1 && body[stored].fn == t_loadimm[LI_A(wl)]) {
+                body[stored].fn = t_loadimm_push[LI_A(wl)];
+                n++;
+            } else if (loaded >> ABC_C(w) & 1u) {
+                body[j].fn = t_ret[w & 0x3Fu];
+                n++;
+            }
+            stored = SIZE_MAX;
+        }
+        int d = op_dest(w);
+        if (d < 0) continue;
+        known &= ~(1u << d);
+        loaded &= ~(1u << d);
+        if (OPC(w) == 13) {
+            known |= 1u << d;
+            li[d] = j;
+        } else if (OPC(w) == 1) {
+            loaded |= 1u << d;
+        }
+    }
+    return n;
+}
+
+/* build the trace from g_rec_blocks and patch its head */
+static void trace_compile(void) {
+    uint32_t head = g_rec.head;
+    uint32_t last = g_rec_blocks[g_rec_nblocks - 1].target;
+    size_t n = g_rec_nops + 1; // + loop/goto tail
+
+    if (g_ntraces == g_traces_cap) {
+        size_t nc = g_traces_cap ? g_traces_cap * 2 : 16;
+        UMTrace *nt = (UMTrace*)realloc(g_traces, nc * sizeof(UMTrace));
+        if (!nt) {
+            rec_abort(); // tracing is optional; keep interpreting
+            return;
+        }
+        g_traces = nt;
+        g_traces_cap = nc;
+    }
+
+    UMOp *ops = (UMOp*)malloc(n * sizeof(UMOp));
+    uint32_t *pcs = (uint32_t*)malloc(n * sizeof(uint32_t));
+    if (!ops || !pcs) {
+        free(ops);
+        free(pcs);
+        rec_abort();
+        return;
+    }
+
+    size_t k = 0;
+    for (size_t i = 0; i < g_rec_nblocks; ++i) {
+        const UMBlock *b = &g_rec_blocks[i];
+
+        for (uint32_t pc = b->start; pc < b->jump; ++pc) {
+            ops[k] = g_code[pc];
+            pcs[k] = pc;
+            g_slot[pc] |= UM_SLOT_TRACED;
+            k++;
+        }
+        if (!b->guard) continue;
+
+        uint32_t w = g_arr[0].data[b->jump];
+        if (g_code[b->jump].fn == h_break) {
+            ops[k] = g_code[b->jump]; // stops, then jumps from g_code
+        } else {
+            ops[k].fn = t_guard[w & 0x3Fu];
+            ops[k].imm = b->target;
+        }
+        pcs[k] = b->jump;
+        g_slot[b->jump] |= UM_SLOT_TRACED;
+        k++;
+    }
+
+    trace_opt(ops, pcs, n);
+
+    if (last == head) {
+        ops[k].fn = h_trace_loop;
+        ops[k].imm = (uint32_t)k;
+    } else if (g_code[last].fn == h_enter) {
+        ops[k].fn = h_trace_link;
+        ops[k].imm = g_code[last].imm;
+    } else { // a cached trace replayed before the one at its target
+        ops[k].fn = h_trace_goto;
+        ops[k].imm = last;
+    }
+    pcs[k] = last;
+
+    UMHoist hoist = { 0 };
+    if (last == head) { // fast copy, entry check and the checked copy (trace_hoist)
+        UMOp *two = (UMOp*)malloc((2 * k + 3) * sizeof(UMOp));
+        uint32_t *two_pcs = (uint32_t*)malloc((2 * k + 3) * sizeof(uint32_t));
+        if (two && two_pcs) {
+            memcpy(two + 1, ops, k * sizeof(UMOp));
+            memcpy(two_pcs + 1, pcs, k * sizeof(uint32_t));
+        }
+        if (two && two_pcs && trace_hoist(two + 1, two_pcs + 1, k, &hoist)) {
+            two[0].fn = h_hoist;
+            two[0].imm = (uint32_t)g_ntraces;
+            two_pcs[0] = head;
+            two[k + 1].fn = h_hoist_loop;
+            two[k + 1].imm = (uint32_t)k;
+            two_pcs[k + 1] = last;
+            memcpy(two + k + 2, ops, (k + 1) * sizeof(UMOp)); // its tail loops to itself
+            memcpy(two_pcs + k + 2, pcs, (k + 1) * sizeof(uint32_t));
+            hoist.slow = (uint32_t)k + 2;
+            g_stats.hoisted++;
+            free(ops);
+            free(pcs);
+            ops = two;
+            pcs = two_pcs;
+            n = 2 * k + 3;
+        } else {
+            free(two);
+            free(two_pcs);
+        }
+    }
+    if (hoist.slow) {
+        g_stats.branches += trace_branches(ops + 1, pcs + 1, k);
+        trace_branches(ops + k + 2, pcs + k + 2, k);
+        if (g_ret_stack) {
+            g_stats.calls += trace_calls(ops + 1, pcs + 1, k);
+            trace_calls(ops + k + 2, pcs + k + 2, k);
+        }
+    } else {
+        g_stats.branches += trace_branches(ops, pcs, k);
+        if (g_ret_stack) g_stats.calls += trace_calls(ops, pcs, k);
+    }
+
+    g_traces[g_ntraces].ops = ops;
+    g_traces[g_ntraces].pcs = pcs;
+    g_traces[g_ntraces].nops = (uint32_t)n;
+    g_traces[g_ntraces].head = head;
+    g_traces[g_ntraces].hoist = hoist;
+    g_slot[head] |= UM_SLOT_TRACED;
+    g_code[head].fn = h_enter;
+    g_code[head].imm = (uint32_t)g_ntraces;
+    g_ntraces++;
+    g_stats.traces++;
+    g_rec.active = 0;
+    cache_keep();
+}
+
+/* recording: the block that started at g_rec.cur just jumped from jpc */
+static void rec_jump(uint32_t jpc, uint32_t target) {
+    if (jpc < g_rec.cur) { // not straight line; never expected
+        rec_abort();
+        return;
+    }
+
+    UMBlock *b = &g_rec_blocks[g_rec_nblocks++];
+    b->start = g_rec.cur;
+    b->jump = jpc;
+    b->target = target;
+    b->guard = 1;
+    g_rec_nops += (size_t)(jpc - g_rec.cur) + 1; // ops + guard
+
+    if (target == g_rec.head || g_code[target].fn == h_enter) {
+        trace_compile();
+    } else if (g_rec_nblocks == UM_TRACE_MAX_BLOCKS || g_rec_nops >= UM_TRACE_MAX_OPS) {
+        rec_abort();
+    } else {
+        g_rec.cur = target;
+        rec_hook();
+    }
+}
+
+/* recording: the block that started at g_rec.cur fell into the trace head
+   at pc without a jump */
+static void rec_fall(uint32_t pc) {
+    if (pc < g_rec.cur) {
+        rec_abort();
+        return;
+    }
+
+    UMBlock *b = &g_rec_blocks[g_rec_nblocks++];
+    b->start = g_rec.cur;
+    b->jump = pc;
+    b->target = pc;
+    b->guard = 0;
+    g_rec_nops += (size_t)(pc - g_rec.cur);
+    trace_compile();
+}
+
+/* drop every trace and restore their heads from array 0 (fused again if
+   an idiom starts there) */
+static void traces_flush(void) {
+    rec_abort();
+    for (size_t i = 0; i < g_ntraces; ++i) {
+        uint32_t h = g_traces[i].head;
+        g_code[h] = decode(g_arr[0].data[h]);
+        bp_sync(h);
+        idioms_fuse(h, h + 1);
+        free(g_traces[i].ops);
+        free(g_traces[i].pcs);
+        free(g_traces[i].hoist.ev);
+    }
+    if (g_ntraces) {
+        for (size_t pc = 0; pc <= g_code_len; ++pc) g_slot[pc] &= (unsigned char)~UM_SLOT_TRACED;
+    }
+    g_ntraces = 0;
+}
+
+/* pc of the op at ip: its g_code slot, or the source pc of a trace copy
+   (a search; only breakpoints, watchpoints and flushes need it) */
+static uint32_t op_pc(const UMOp *ip) {
+    uintptr_t p = (uintptr_t)ip;
+    uintptr_t lo = (uintptr_t)g_code, hi = (uintptr_t)(g_code + g_code_len);
+    if (p >= lo && p <= hi) return (uint32_t)(ip - g_code);
+    for (size_t i = 0; i < g_ntraces; ++i) {
+        const UMTrace *t = &g_traces[i];
+        if (p >= (uintptr_t)t->ops && p < (uintptr_t)(t->ops + t->nops)) return t->pcs[ip - t->ops];
+    }
+    return 0; // not reached: every op is in g_code or a trace
+}
+
+/* aupd wrote array 0 at off, a slot with g_slot flags (or not decoded yet):
+   re-decode it and continue after the aupd. If a trace copied that word,
+   flush them all and continue in g_code (the aupd itself may be running
+   from one, hence resolving its pc first); otherwise a running trace
+   carries on, since nothing it copied changed. Rewriting the end of the
+   block being recorded stops the recording. */
+static const UMOp *code_written(const UMOp *ip, uint32_t off) {
+    int flush = g_slot[off] & UM_SLOT_TRACED;
+    uint32_t pc = flush ? op_pc(ip) : 0;
+
+    if (g_slot[off] & UM_SLOT_HOOK) rec_abort();
+    if (flush) traces_flush();
+    // while streaming, words past the decoded part are decoded on arrival
+    if (off < g_code_len) {
+        g_code[off] = decode(g_arr[0].data[off]);
+        bp_sync(off);
+        for (uint32_t j = 1; j < 3 && j <= off; ++j) { // an idiom fused over off
+            if (is_fused(off - j)) g_code[off - j] = decode(g_arr[0].data[off - j]);
+        }
+    }
+    return flush ? g_code + pc + 1 : ip + 1;
+}
+
+/*-------------------------------- breakpoints --------------------------------*/
+// A breakpoint keeps its slot's op and swaps only the handler for h_break,
+// which stops in the debugger and then tail-calls the op's own handler on
+// that g_code slot (a hit inside a trace continues outside it). Trace heads
+// are never breakpoints, and setting or clearing one drops all traces, so
+// every copy of a slot matches it. Re-decoding re-patches.
+
+static UM_TLS uint32_t *g_bps = NULL; // user breakpoints (unordered)
+static UM_TLS size_t g_nbps = 0, g_bps_cap = 0;
+static UM_TLS uint32_t g_step = UINT32_MAX; // one-shot stop (debugger step)
+
+static int bp_at(uint32_t pc) {
+    if (pc == g_step) return 1;
+    for (size_t i = 0; i < g_nbps; ++i) {
+        if (g_bps[i] == pc) return 1;
+    }
+    return 0;
+}
+
+/* slot pc (already decoded) gets h_break or its own handler back */
+static void bp_sync(uint32_t pc) {
+    if (pc >= g_code_len) return;
+    if (bp_at(pc)) {
+        g_code[pc].fn = h_break;
+        g_slot[pc] |= UM_SLOT_BREAK;
+    } else {
+        g_code[pc].fn = decode(g_arr[0].data[pc]).fn;
+        g_slot[pc] &= (unsigned char)~UM_SLOT_BREAK;
+    }
+}
+
+/* patch the breakpoints among freshly decoded slots lo..hi-1 */
+static void bps_apply(size_t lo, size_t hi) {
+    if (g_step >= lo && g_step < hi) {
+        g_code[g_step].fn = h_break;
+        g_slot[g_step] |= UM_SLOT_BREAK;
+    }
+    for (size_t i = 0; i < g_nbps; ++i) {
+        if (g_bps[i] >= lo && g_bps[i] < hi) {
+            g_code[g_bps[i]].fn = h_break;
+            g_slot[g_bps[i]] |= UM_SLOT_BREAK;
+        }
+    }
+}
+
+int engine_break(uint32_t pc, int on) {
+    size_t i = 0;
+    while (i < g_nbps && g_bps[i] != pc) ++i;
+    if (on == (i < g_nbps)) return 0;
+
+    if (!on) {
+        g_bps[i] = g_bps[--g_nbps];
+    } else {
+        if (g_nbps == g_bps_cap) {
+            size_t nc = g_bps_cap ? g_bps_cap * 2 : 16;
+            uint32_t *nb = (uint32_t*)realloc(g_bps, nc * sizeof *nb);
+            if (!nb) return 0;
+            g_bps = nb;
+            g_bps_cap = nc;
+        }
+        g_bps[g_nbps++] = pc;
+    }
+    if (g_code) {
+        traces_flush();
+        bp_sync(pc);
+    }
+    return 1;
+}
+
+size_t engine_breaks(const uint32_t **pcs) {
+    *pcs = g_bps;
+    return g_nbps;
+}
+
+/* trap at a breakpoint: stop, then run the op. A step sets a one-shot stop
+   where it goes next (its jump target, given the registers now). */
+HANDLER(h_break) {
+    uint32_t pc = op_pc(ip);
+    uint32_t w = g_arr[0].data[pc];
+
+    if (pc == g_step) {
+        g_step = UINT32_MAX;
+        bp_sync(pc);
+    }
+    if (debug_stop(pc, r) && OPC(w) != 7) { // may flush traces (and ip with them)
+        g_step = OPC(w) == 12 ? r[ABC_C(w)] : pc + 1;
+        traces_flush();
+        bp_sync(g_step);
+    }
+    ip = g_code + pc;
+#ifdef UM_TAILCALL
+    UM_MUSTTAIL return decode(w).fn(ip, r);
+#else
+    return decode(w).fn(ip, r);
+#endif
+}
+
+/*------------------------------ persistent cache -----------------------------*/
+// Each image array 0 starts out as (at boot or after a program swap) has its
+// own cache file. Recordings are kept as they are compiled, and survive later
+// flushes, if every word they copied still matches that image; at most one
+// per head.
+
+#define UM_CACHE_MAX_TRACES 4096u // per image
+#define UM_CACHE_MAX_IMAGES 16u // images keyed per run (each costs a hash)
+
+static UM_TLS struct {
+    const char *dir; // NULL: no cache
+    uint64_t key;
+    uint32_t *img; // copy of the current image as loaded
+    uint32_t nimg;
+    unsigned char *kept; // per image pc: a kept trace starts here
+    CCTrace *traces;
+    uint32_t ntraces, traces_cap;
+    CCBlock *blocks;
+    uint32_t nblocks, blocks_cap;
+    uint32_t loaded; // kept traces that came from the file
+    uint32_t nimages; // images keyed so far
+} g_cc;
+
+/* pc holds the same word as when the image was loaded */
+static int cache_same(uint32_t pc) {
+    return pc < g_cc.nimg && pc < g_arr[0].len && g_arr[0].data[pc] == g_cc.img[pc];
+}
+
+/* trace_compile just built g_rec_blocks at g_rec.head: keep it if valid */
+static void cache_keep(void) {
+    uint32_t head = g_rec.head;
+    uint32_t nb = (uint32_t)g_rec_nblocks;
+
+    if (!g_cc.kept || g_cc.ntraces == UM_CACHE_MAX_TRACES) return;
+    if (!cache_same(head) || g_cc.kept[head]) return;
+    for (uint32_t i = 0; i < nb; ++i) {
+        const UMBlock *b = &g_rec_blocks[i];
+        for (uint32_t pc = b->start; pc < b->jump; ++pc) {
+            if (!cache_same(pc)) return;
+        }
+        if (b->guard && !cache_same(b->jump)) return;
+        if (b->target > g_cc.nimg) return;
+    }
+
+    if (g_cc.ntraces == g_cc.traces_cap) {
+        uint32_t nc = g_cc.traces_cap ? g_cc.traces_cap * 2 : 64;
+        CCTrace *nt = (CCTrace*)realloc(g_cc.traces, nc * sizeof(CCTrace));
+        if (!nt) return;
+        g_cc.traces = nt;
+        g_cc.traces_cap = nc;
+    }
+    if (g_cc.nblocks + nb > g_cc.blocks_cap) {
+        uint32_t nc = g_cc.blocks_cap ? g_cc.blocks_cap * 2 : 256;
+        while (nc < g_cc.nblocks + nb) nc *= 2;
+        CCBlock *nbk = (CCBlock*)realloc(g_cc.blocks, nc * sizeof(CCBlock));
+        if (!nbk) return;
+        g_cc.blocks = nbk;
+        g_cc.blocks_cap = nc;
+    }
+
+    for (uint32_t i = 0; i < nb; ++i) {
+        const UMBlock *b = &g_rec_blocks[i];
+        g_cc.blocks[g_cc.nblocks++] = (CCBlock){ b->start, b->jump, b->target, (uint32_t)b->guard };
+    }
+    g_cc.traces[g_cc.ntraces++] = (CCTrace){ head, nb };
+    g_cc.kept[head] = 1;
+}
+
+/* a cached recording is well formed for the current image (length n) and
+   its decode. A fused op skips the rest of its idiom, so no block may end
+   inside one; a recording made with fusing off (--break) can. */
+static int cache_valid(const CCTrace *t, const CCBlock *b, uint32_t n) {
+    const uint32_t *w = g_arr[0].data;
+    uint32_t at = t->head;
+    size_t ops = 0;
+    UMOp op;
+    unsigned kind;
+
+    if (t->nblocks == 0 || t->nblocks > UM_TRACE_MAX_BLOCKS || t->head >= n) return 0;
+    for (uint32_t i = 0; i < t->nblocks; ++i) {
+        if (b[i].start != at || b[i].jump < b[i].start || b[i].jump >= n || b[i].target > n) return 0;
+        for (uint32_t pc = b[i].start; pc < b[i].jump; ++pc) {
+            if (OPC(w[pc]) == 12 || OPC(w[pc]) == 7) return 0; // blocks are straight line
+        }
+        for (uint32_t pc = b[i].start; pc < b[i].jump; ++pc) {
+            unsigned len = is_fused(pc) ? idiom_at(w, pc, g_code_len, &op, &kind) : 0;
+            if (len > 1) {
+                if (pc + len > b[i].jump) return 0;
+                pc += len - 1;
+            }
+        }
+        if (b[i].guard ? OPC(w[b[i].jump]) != 12 : i + 1 != t->nblocks) return 0;
+        ops += (size_t)(b[i].jump - b[i].start) + 1;
+        at = b[i].target;
+    }
+    return ops <= UM_TRACE_MAX_OPS + UM_TRACE_MAX_BLOCKS;
+}
+
+/* save the image's kept traces if this run added any, then forget them */
+static void cache_save(void) {
+    if (g_cc.ntraces > g_cc.loaded) {
+        if (cc_save(g_cc.dir, g_cc.key, g_cc.nimg, g_cc.traces, g_cc.ntraces,
+                    g_cc.blocks, g_cc.nblocks) != 0) {
+            fprintf(stderr, "warning: cannot write code cache in %s\n", g_cc.dir);
+        }
+    }
+    free(g_cc.img);
+    free(g_cc.kept);
+    g_cc.img = NULL;
+    g_cc.kept = NULL;
+    g_cc.ntraces = g_cc.nblocks = g_cc.loaded = 0;
+}
+
+/* array 0 was just (re)loaded: key it and compile the traces cached for it */
+static void cache_image(void) {
+    if (!g_cc.dir) return;
+    if (g_stream_len) stream_decode(g_stream_len); // keys cover the whole image
+    cache_save();
+    // programs that keep swapping images would pay a hash per swap
+    if (++g_cc.nimages > UM_CACHE_MAX_IMAGES) return;
+
+    uint32_t n = (uint32_t)g_arr[0].len;
+    g_cc.key = cc_key(g_arr[0].data, n);
+    g_cc.nimg = n;
+    g_cc.img = (uint32_t*)malloc((n + 1) * sizeof(uint32_t));
+    g_cc.kept = (unsigned char*)calloc(n + 1, 1);
+    if (!g_cc.img || !g_cc.kept) {
+        free(g_cc.img);
+        free(g_cc.kept);
+        g_cc.img = NULL;
+        g_cc.kept = NULL;
+        g_cc.dir = NULL; // the cache is optional
+        return;
+    }
+    if (n > 0) memcpy(g_cc.img, g_arr[0].data, n * sizeof(uint32_t));
+
+    CodeCache cc;
+    if (cc_open(&cc, g_cc.dir, g_cc.key, n) != 0) return;
+
+    const CCBlock *b = cc.blocks;
+    for (uint32_t i = 0; i < cc.ntraces; ++i) {
+        const CCTrace *t = &cc.traces[i];
+        if ((size_t)(b - cc.blocks) + t->nblocks > cc.nblocks) break;
+        if (cache_valid(t, b, n) && g_code[t->head].fn != h_enter && g_code[t->head].fn != h_break) {
+            g_rec.head = t->head;
+            g_rec_nblocks = t->nblocks;
+            g_rec_nops = 0;
+            for (uint32_t k = 0; k < t->nblocks; ++k) {
+                g_rec_blocks[k] = (UMBlock){ b[k].start, b[k].jump, b[k].target, b[k].guard != 0 };
+                g_rec_nops += (size_t)(b[k].jump - b[k].start) + (b[k].guard != 0);
+            }
+            trace_compile();
+        }
+        b += t->nblocks;
+    }
+    g_cc.loaded = g_cc.ntraces;
+    cc_close(&cc);
+}
+
+/* at halt: save the current image's traces and release the cache */
+static void cache_close(void) {
+    if (g_cc.dir) cache_save();
+    free(g_cc.traces);
+    free(g_cc.blocks);
+    memset(&g_cc, 0, sizeof g_cc);
+}
+
+/*------------------------------------ run ------------------------------------*/
+int engine_run(const EngineConfig *cfg) {
+    g_jit = cfg->jit;
+    g_ret_stack = cfg->ret_stack;
+    g_fuse = g_nbps == 0;
+    dec_init();
+    decode_all(cfg->sel);
+    g_cc.dir = g_jit ? cfg->cache_dir : NULL;
+    cache_image();
+
+    uint32_t regs[8] = {0};
+    const UMOp *ip = g_code;
+
+    while (ip) ip = ip->fn(ip, regs);
+
+    if (cfg->stats) {
+        fprintf(stderr, "stats: idioms fused: and %llu, notadd %llu, sub %llu (lone not: %llu)\n",
+                (unsigned long long)g_stats.idioms[UM_ID_AND], (unsigned long long)g_stats.idioms[UM_ID_NOTADD],
+                (unsigned long long)g_stats.idioms[UM_ID_SUB], (unsigned long long)g_stats.nots);
+        fprintf(stderr, "stats: traces %llu (%llu with hoisted checks), check-free trace ops %llu, "
+                "lowered branches %llu, divs by a constant %llu\n",
+                (unsigned long long)g_stats.traces, (unsigned long long)g_stats.hoisted,
+                (unsigned long long)g_stats.checkfree, (unsigned long long)g_stats.branches,
+                (unsigned long long)g_stats.divk);
+        if (g_ret_stack) {
+            fprintf(stderr, "stats: return stack: calls and returns marked %llu\n",
+                    (unsigned long long)g_stats.calls);
+        }
+    }
+    engine_release();
+    arrays_destroy();
+    return 0;
+}
+
+void engine_release(void) {
+    cache_close();
+    traces_flush();
+    free(g_traces);
+    g_traces = NULL;
+    g_traces_cap = 0;
+    free(g_code);
+    free(g_slot);
+    free(g_hits);
+    free(g_bps);
+    g_bps = NULL;
+    g_nbps = g_bps_cap = 0;
+    g_step = UINT32_MAX;
+    g_code = NULL;
+    g_slot = NULL;
+    g_hits = NULL;
+    g_code_len = g_code_cap = 0;
+    g_ndivk = 0;
+}
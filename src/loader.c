@@ -6,13 +6,21 @@
 // What this program does (high level):
 //   - Loads a .um program as big-endian 32-bit words into “array 0”.
 //   - Initializes 8 x 32-bit registers to 0 and pc = 0.
-//   - Runs a fetch/decode/execute loop implementing opcodes 0..13.
+//   - Runs opcodes 0..13 on the threaded engine (src/engine.c: pre-decoded,
+//     operand-specialized handlers) or on the reference fetch/decode/execute
+//     switch loop below (--engine=switch, and always when tracing).
 //   - Supports optional instruction tracing to stderr.
 //   - Fails fast (with a short message) on any spec violation.
 //
 // CLI:
-//   usage: ./BUILD/loader [--trace] <program.um>
+//   usage: ./BUILD/loader [--trace[=FILE]] [--trusted] [--engine=E] [--no-jit]
+//                         [--ret-stack] [--code-cache=DIR] [--umc] [--shm] [--stream]
+//                         [--input=FILE] [--output=M] [--watch=ID:OFF[:LEN]]
+//                         [--break=PC[,PC...]] [--break-cmds=FILE] [--zero=Z]
+//                         [--stats] <program.um|program.umc|->
+//          ./BUILD/loader [options] --pipe <a.um> <b.um> ...   (a | b | ...)
 //   env   : UM_TRACE_LIMIT=N   (optional; caps the trace once pc >= N)
+//           UM_TRACE_POLICY=block|drop (trace writer falling behind)
 //   help  : -h / --help
 //
 // Fielding (matches disasm/asm):
@@ -28,6 +36,20 @@
 // Error handling:
 //   - On any spec violation (e.g., divide by zero, OOB access, bad id), print
 //     “fail: …” and exit(1) after freeing any allocated arrays.
+//
+// Trusted mode (--trusted):
+//   - Array 0 always carries one extra sentinel trap word past its end, so a
+//     pc that runs off the program lands on a trap instead of needing a
+//     bounds check at every cycle start.
+//   - At load we walk the straight-line path from pc 0 (following loadprog 0
+//     jumps whose target is a known loadimm constant) and reject the program
+//     if that path hits an invalid opcode.
+//   - The trusted loop drops the per-cycle pc check; invalid opcodes (14/15)
+//     and the sentinel share one trap case, so spec failures that can only
+//     happen at run time (bad jumps, /0, OOB, bad ids) still fail as usual.
+//   - Only the switch loop has a trusted variant. The threaded engine decodes
+//     invalid opcodes and the sentinel into trap slots and checks nothing per
+//     cycle either way, so there --trusted only adds the load-time walk.
 // -----------------------------------------------------------------------------
 #define _POSIX_C_SOURCE 200809L // expose POSIX_APIs like fseeko/ftello
 #define _FILE_OFFSET_BITS 64 // make off_t 64-bit
@@ -36,13 +58,24 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <inttypes.h> // PRIx64
 #include <errno.h>
 #include <string.h>
+#include <unistd.h> // access
+#include <pthread.h>
 
 #include "trace.h"
+#include "um.h"
+#include "engine.h"
+#include "debugger.h"
+#include "reclaim.h"
+#include "zero.h"
+#include "umc.h"
+#include "ring.h"
 #ifdef TRACE
 int g_trace_enabled = 0;
 #endif
+
 /*-------------- tiny utils --------------- */ 
 
 /* simple fatal helper for non-VM errors (I/O, OOM during load, etc.) */
@@ -66,21 +99,70 @@ static void print_help(const char *prog) {
     "UM emulator\n"
     "\n"
     "Usage:\n"
-    "  %s [--trace] <program.um>\n"
+    "  %s [options] <program.um | program.umc>\n"
+    "  %s [options] --pipe <a.um> <b.um> ...\n"
     "\n"
     "Options:\n"
     "  -h, --help  Show this help and exit\n"
     "  --trace     Print a per-instruction trace to stderr\n"
+    "  --trace=FILE\n"
+    "              Write it to FILE as a compressed binary trace instead\n"
+    "              (read it back with um-trace)\n"
+    "  --trusted   Verify the program at load; --engine=switch then runs\n"
+    "              without per-cycle pc/opcode checks (the threaded engine\n"
+    "              never has them). Run-time faults still fail\n"
+    "  --engine=E  threaded (default) or switch (reference loop;\n"
+    "              always used with --trace)\n"
+    "  --no-jit    Threaded engine without hot-path traces\n"
+    "  --ret-stack Predict returns in traces with a shadow return stack\n"
+    "              (experimental; see README)\n"
+    "  --code-cache=DIR\n"
+    "              Save traces per program in DIR and reuse them on the\n"
+    "              next run of the same program (threaded engine)\n"
+    "  --umc       Run from program.umc (pre-decoded, mapped) when it is\n"
+    "              up to date, else load program.um and write the .umc\n"
+    "  --shm       Like --umc, but the image lives in /dev/shm (or\n"
+    "              $UM_SHM_DIR) so concurrent runs share one copy\n"
+    "  --stream    Start running while a loader thread still reads the\n"
+    "              .um (threaded engine, plain .um files)\n"
+    "  --input=FILE\n"
+    "              Program input (`in`) comes from FILE instead of stdin\n"
+    "  --pipe      Run the programs given as a pipeline (a | b | ...), one\n"
+    "              thread each, joined by in-process byte rings\n"
+    "  --watch=ID:OFF[:LEN]\n"
+    "              Report each write (pc, old and new value) to words\n"
+    "              OFF..OFF+LEN-1 of array ID on stderr\n"
+    "  --output=M  stdout (default), null (discard `out`), or hash (print\n"
+    "              a 64-bit FNV-1a of all output at halt instead)\n"
+    "  --break=PC[,PC...]\n"
+    "              Stop before these instructions and read debugger commands\n"
+    "              (h lists them) from the terminal (threaded engine)\n"
+    "  --break-cmds=FILE\n"
+    "              Read the debugger commands from FILE (or a FIFO)\n"
+    "  --zero=Z    calloc (default: fresh demand-zero pages) or parallel\n"
+    "              (alloc of 16 MiB and up reuses a just-freed array of the\n"
+    "              same size, zeroed on one thread per CPU)\n"
+    "  --stats     At halt, print what the threaded engine's decoder and\n"
+    "              trace compiler did (fused idioms, traces) on stderr\n"
+    "\n"
+    "The program may be '-' (stdin) or any pipe, e.g.\n"
+    "  asm prog.uma -o - | loader --input data.txt -\n"
+    "\n"
+    "A .umc path is mapped directly; if the matching .um is newer, the\n"
+    "loader falls back to it and refreshes the .umc.\n"
     "\n"
     "Environment (tracing):\n"
     "  UM_TRACE_LIMIT=N  Stop printing trace once PC >= N\n"
+    "  UM_TRACE_POLICY=block|drop\n"
+    "                    When the trace writer falls behind, stall the VM\n"
+    "                    (default) or drop records and count them\n"
     "\nBuild modes (see Makefile targets):\n"
     "  debug   -O0 + ASan/UBSan\n"
     "  release -O3 -DNDEBUG\n"
     "  perf    -O3 -DNDEBUG -flto\n"
     "\n"
     "\nThis binary was built as: %s\n", 
-    prog, build_mode());
+    prog, prog, build_mode());
 }
 
 /*---------------------------- word/bitfield utils -----------------------------*/
@@ -93,53 +175,17 @@ static inline uint32_t be32_from(const unsigned char b[4]) {
            ((uint32_t)b[3] << 0);
 }
 
-/* field extractors */
-static inline unsigned OPC(uint32_t w) { return w >> 28; } // bits 28..31
-static inline unsigned ABC_A(uint32_t w) { return (w >> 6) & 7u; } // bits 6..8
-static inline unsigned ABC_B(uint32_t w) {return (w >> 3) & 7u; } // bits 3..5
-static inline unsigned ABC_C(uint32_t w) { return (w >> 0) & 7u; } // bits 0..2
-static inline unsigned LI_A(uint32_t w) { return (w >> 25) & 7u; } // bits 25..27
-static inline unsigned LI_VAL(uint32_t w) {return w & 0x1FFFFFFu; } // bits 0..24
-
-/* pretty names for trace */
-#ifdef TRACE
-static const char *opname(unsigned op) {
-    switch (op) {
-        case 0: return "cmov";
-        case 1: return "aidx";
-        case 2: return "aupd";
-        case 3: return "add";
-        case 4: return "mul";
-        case 5: return "div";
-        case 6: return "nand";
-        case 7: return "halt";
-        case 8: return "alloc";
-        case 9: return "dealloc";
-        case 10: return "out";
-        case 11: return "in";
-        case 12: return "loadprog";
-        case 13: return "loadimm";
-        default: return "?";
-    }
-}
-#endif
-
 /*--------------------------- array registry (“heap”) --------------------------*/
-typedef struct {
-    uint32_t *data; // NULL if length 0 or after free
-    size_t len; // number of words
-    int active; // 1 if allocated (including id 0 for program), 0 otherwise
-} UMArray;
-
-// Registry
-static UMArray *g_arr = NULL; // ids: 0 .. g_arr_len - 1
-static size_t g_arr_len = 0;
-static size_t g_arr_cap = 0;
+// Registry (UMArray lives in um.h so the threaded engine can share it)
+// (per thread, like all VM state: see --pipe)
+UM_TLS UMArray *g_arr = NULL; // ids: 0 .. g_arr_len - 1
+UM_TLS size_t g_arr_len = 0;
+static UM_TLS size_t g_arr_cap = 0;
 
 // free-id stack
-static uint32_t *g_free_ids = NULL; // LIFO stack of reusable ids
-static size_t g_free_len = 0;
-static size_t g_free_cap = 0;
+static UM_TLS uint32_t *g_free_ids = NULL; // LIFO stack of reusable ids
+static UM_TLS size_t g_free_len = 0;
+static UM_TLS size_t g_free_cap = 0;
 
 /* ensure registry has room for at least need_cap slots */
 static void arr_reserve(size_t need_cap) {
@@ -176,18 +222,21 @@ static void freeids_reserve(size_t need_cap) {
 }
 
 /* obtain a fresh array id (reusing from free stack if possible) */
-static uint32_t id_acquire(void) {
+uint32_t id_acquire(void) {
     if (g_free_len > 0) return g_free_ids[--g_free_len];
     arr_reserve(g_arr_len + 1);
     return (uint32_t)g_arr_len++; // after boot, this will be >= 1
 }
 
 /* return an id to the free stack */
-static void id_release(uint32_t id) {
+void id_release(uint32_t id) {
     freeids_reserve(g_free_len + 1);
     g_free_ids[g_free_len++] = id;
 }
 
+// array 0 may live in a mapped .umc instead of the heap (see load_image)
+static UM_TLS UMCImage g_arr0_umc;
+
 /* initialize registry with program as array 0 */
 static void arrays_boot(uint32_t *program, size_t nwords) {
     arr_reserve(1);
@@ -197,10 +246,33 @@ static void arrays_boot(uint32_t *program, size_t nwords) {
     g_arr[0].active = 1;
 }
 
+/* release array 0's words (heap buffer or .umc mapping) */
+static void program_release(void) {
+    stream_finish(); // the loader thread may still be writing them
+    if (g_arr0_umc.map && g_arr[0].data == g_arr0_umc.words) {
+        umc_unmap(&g_arr0_umc);
+    } else {
+        reclaim_free(g_arr[0].data, (g_arr[0].len + 1) * sizeof(uint32_t));
+    }
+    g_arr[0].data = NULL;
+}
+
+/* install a heap program (len words + sentinel) as array 0 */
+void program_replace(uint32_t *data, size_t len) {
+    if (g_watch.on && g_watch.id == 0) {
+        fprintf(stderr, "watch: array 0 replaced by loadprog (%zu words)\n", len);
+    }
+    program_release();
+    g_arr[0].data = data;
+    g_arr[0].len = len;
+    g_arr[0].active = 1;
+}
+
 /* free every allocated array and reset globals */
-static void arrays_destroy(void) {
+void arrays_destroy(void) {
+    if (g_arr_len > 0) program_release();
     for (size_t i = 0; i < g_arr_len; ++i) {
-        free(g_arr[i].data); // free(NULL) ok, frees program aswell
+        free(g_arr[i].data); // free(NULL) ok; array 0 is already released
         g_arr[i].data = NULL;
         g_arr[i].len = 0;
         g_arr[i].active = 0;
@@ -215,31 +287,47 @@ static void arrays_destroy(void) {
     g_free_len = g_free_cap = 0;
 }
 
+// program I/O (NULL: stdin/stdout) and, in a --pipe stage, its program.
+// Only the VM thread touches stdin/stdout (--pipe stages use rings), so `in`
+// and `out` use the _unlocked calls: once another thread exists (the
+// reclaimer, a stream loader) plain getchar/putchar take the FILE lock on
+// every byte.
+UM_TLS UMRing *g_in_ring = NULL;
+UM_TLS UMRing *g_out_ring = NULL;
+UM_TLS int g_out_mode = UM_OUT_STDOUT;
+UM_TLS uint64_t g_out_hash = UM_HASH_INIT;
+static UM_TLS const char *g_stage = NULL;
+
+UMWatch g_watch = { 0, 0, 0, 0 };
+
+/* a watched word is being written (before the store) */
+void watch_hit(uint32_t pc, uint32_t id, uint32_t off, uint32_t old, uint32_t val) {
+    if (g_stage) fprintf(stderr, "watch: %s: ", g_stage);
+    else fputs("watch: ", stderr);
+    fprintf(stderr, "pc=%u mem[%u][%u]: 0x%08x -> 0x%08x%s\n",
+            pc, id, off, old, val, old == val ? " (same)" : "");
+}
+
 /* VM-spec failure path: print, cleanup, exit */
-static void fail_and_exit(const char *msg) {
-    fprintf(stderr, "fail: %s\n", msg);
+void fail_and_exit(const char *msg) {
+    #ifdef TRACE
+        trace_stop(); // the trace so far, ahead of the message
+    #endif
+    if (g_stage) fprintf(stderr, "fail: %s: %s\n", g_stage, msg);
+    else fprintf(stderr, "fail: %s\n", msg);
     arrays_destroy();
     exit(1);
 }
 
-/* print register deltas for trace (only if any changed) */
-#ifdef TRACE
-static void dump_reg_changes(uint32_t before[8], uint32_t after[8]) {
-    for (int i = 0; i < 8; ++i) {
-        if(before[i] != after[i]) {
-            TRACEF("   r%d: %u -> %u\n", i, before[i], after[i]);
-        }
-    }
-}
-#endif
-
-/* Swallow --trace/-t on the commandline */
+/* Swallow --trace/-t/--trace=FILE on the commandline */
 static void parse_trace_flag(int *argc, char ***argv) {
     for (int i = 1; i < *argc; ++i) {
         const char *arg = (*argv)[i];
-        if (strcmp(arg, "--trace") == 0 || strcmp(arg, "-t") == 0) {
+        if (strcmp(arg, "--trace") == 0 || strcmp(arg, "-t") == 0 ||
+            strncmp(arg, "--trace=", 8) == 0) {
             #ifdef TRACE
                 g_trace_enabled = 1;
+                if (arg[7] == '=') g_trace_path = arg + 8;
             #endif
                 //remove the arg from argv and continue scanning
                 memmove(&(*argv)[i], &(*argv)[i + 1], (size_t)((*argc) - i - 1) * sizeof(char *));
@@ -249,102 +337,113 @@ static void parse_trace_flag(int *argc, char ***argv) {
     }
 }
 
-/*------------------------------------ main -----------------------------------*/
-int main(int argc, char **argv) {
-    parse_trace_flag(&argc, &argv);
-
-    #ifdef TRACE
-        int trace_on = 0;
-        trace_on = g_trace_enabled;
-        if (trace_on) setvbuf(stderr, NULL, _IONBF, 0);
-    #endif
-
-    int argi = 1;
-
-    // -h / --help (accept anywhere for convenience)
-    for (int i = 1; i < argc; ++i) {
-        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
-            print_help(argv[0]);
-            return 0;
+/* Swallow every occurrence of a boolean flag; returns 1 if it was present */
+static int take_flag(int *argc, char ***argv, const char *name) {
+    int found = 0;
+    for (int i = 1; i < *argc; ++i) {
+        if (strcmp((*argv)[i], name) == 0) {
+            found = 1;
+            memmove(&(*argv)[i], &(*argv)[i + 1], (size_t)((*argc) - i - 1) * sizeof(char *));
+            --(*argc);
+            --i;
         }
     }
+    return found;
+}
 
-    #ifdef TRACE
-    unsigned trace_limit = 0;
-    if (trace_on) {
-        const char *lim = getenv("UM_TRACE_LIMIT");
-        if (lim && *lim) trace_limit = (unsigned)strtoul(lim, NULL, 0);
-    }
-    #endif
-
-    // exactly one positional argument is required at this point
-    if (argc - argi != 1) {
-        fprintf(stderr, "usage: %s [--trace] <program.um>\n"
-                        "try '%s --help' for more info\n", argv[0], argv[0]);
-        return 2;
-    }
-    const char *path = argv[argi];
-
-    /*--------------------------- read .um into memory ------------------------*/
-
-    FILE *fPath = fopen(path, "rb");
-    if (!fPath) {
-        fprintf(stderr, "cannot open %s: %s\n", path, strerror(errno));
-        return 1;
-    }
-
-    /* Find file size (64-bit friendly), then rewind */
-    if (fseeko(fPath, 0, SEEK_END) != 0) {
-        fclose(fPath);
-        die("fseeko failed");
+/* Swallow "--name=value" or "--name value"; returns the value or NULL.
+   The last occurrence wins. */
+static const char *take_opt(int *argc, char ***argv, const char *name) {
+    const char *val = NULL;
+    size_t nlen = strlen(name);
+    for (int i = 1; i < *argc; ++i) {
+        const char *arg = (*argv)[i];
+        int used = 0;
+        if (strncmp(arg, name, nlen) == 0 && arg[nlen] == '=') {
+            val = arg + nlen + 1;
+            used = 1;
+        } else if (strcmp(arg, name) == 0 && i + 1 < *argc) {
+            val = (*argv)[i + 1];
+            used = 2;
+        }
+        if (used) {
+            memmove(&(*argv)[i], &(*argv)[i + used], (size_t)((*argc) - i - used) * sizeof(char *));
+            *argc -= used;
+            --i;
+        }
     }
+    return val;
+}
 
-    off_t size = ftello(fPath);
-
-    if (size < 0) {
-        fclose(fPath);
-        die("ftello failed");
-    }
+/*--------------------------- trusted-mode verifier ---------------------------*/
+
+/* Walk the deterministic path from pc 0: registers start at 0, loadimm makes
+   a register known, any other write makes it unknown. The walk follows
+   loadprog 0 jumps with a known target and stops at halt, at a jump it
+   cannot resolve, at a loadprog that replaces array 0, or when it loops.
+   Returns the pc of the first invalid opcode on that path, or nwords if the
+   path is clean. */
+static size_t verify_entry_path(const uint32_t *words, size_t nwords) {
+    unsigned char *seen = (unsigned char*)calloc(nwords, 1);
+    if (!seen) die("out of memory (verify)");
+
+    uint32_t val[8] = {0};
+    unsigned known = 0xFFu; // bit i set: val[i] holds regs[i]
+    size_t pc = 0;
+    size_t bad = nwords;
+
+    while (pc < nwords && !seen[pc]) {
+        seen[pc] = 1;
+        uint32_t w = words[pc];
+        unsigned op = OPC(w);
+
+        if (op > 13u) {
+            bad = pc;
+            break;
+        }
 
-    if (fseeko(fPath, 0, SEEK_SET) != 0) {
-        fclose(fPath);
-        die("fseeko rewind failed");
-    }
+        if (op == 13u) {
+            val[LI_A(w)] = LI_VAL(w);
+            known |= 1u << LI_A(w);
+            pc++;
+            continue;
+        }
 
-    /* Program file size is always divisible by 4. */
-    if (size == 0) {
-        fclose(fPath);
-        die(".um file is empty");
-    }
+        unsigned A = ABC_A(w), B = ABC_B(w), C = ABC_C(w);
+        if (op == 7u) break; // halt
+        if (op == 12u) {
+            if (!(known >> B & 1u) || val[B] != 0 || !(known >> C & 1u)) break;
+            pc = val[C];
+            continue;
+        }
 
-    if ((size & 3) != 0) {
-        fclose(fPath);
-        die(".um size not divisible by 4");
+        // everything else may clobber its destination register
+        if (op <= 6u) known &= ~(1u << A);
+        else if (op == 8u) known &= ~(1u << B);
+        else if (op == 11u) known &= ~(1u << C);
+        pc++;
     }
 
-    size_t nwords = (size_t)(size / 4);
-    uint32_t *words = (uint32_t*)malloc(nwords * sizeof(uint32_t));
+    free(seen);
+    return bad;
+}
 
-    if (!words) {
-        fclose(fPath);
-        die("out of memory");
-    }
+/*-------------------------------- VM run loop --------------------------------*/
 
-    /* Read 4 bytes -> assemble one big-endian word -> store */
-    unsigned char buf[4];
-    for (size_t i = 0; i < nwords; ++i) {
-        size_t got = fread(buf, 1, 4, fPath);
-        if (got != 4) {
-            free(words);
-            fclose(fPath);
-            die("short read");
-        }
-        words[i] = be32_from(buf); /* A is MSB */
-    }
-    fclose(fPath);
+#ifdef TRACE
+static int g_trace_on = 0; // trace requested for this run
+static unsigned g_trace_limit = 0; // UM_TRACE_LIMIT (0 = no limit)
+#endif
 
-    // boot machine arrays: id 0 = program
-    arrays_boot(words, nwords);
+/* Fetch/decode/execute until halt. `trusted` is a compile-time constant in
+   each caller: the checked loop tests pc at every cycle start, the trusted
+   loop relies on the sentinel after array 0 and only checks jump targets.
+   Returns the process exit status (0 on halt). */
+static ALWAYS_INLINE int vm_run(const int trusted) {
+    #ifdef TRACE
+        int trace_on = g_trace_on;
+        unsigned trace_limit = g_trace_limit;
+    #endif
 
     // Cache array-0 program for fast fetch/bounds
     uint32_t *code0 = g_arr[0].data;
@@ -359,39 +458,23 @@ int main(int argc, char **argv) {
         // stop tracing after pc >= limit (if set)
         #ifdef TRACE
         if (trace_on && trace_limit && pc >= trace_limit) {
-            fprintf(stderr, "[trace disabled after pc=%u]\n", pc);
+            trace_push(TR_STOP, pc, 0, regs);
             g_trace_enabled = 0;
             trace_on = 0;
         }
         #endif
         // Exception: if at cycle start PC outside 0-array capacity is a Fail
-        if ((uint32_t)pc >= code0_len) {
+        if (!trusted && (uint32_t)pc >= code0_len) {
             fail_and_exit("PC out of bounds at cycle start");
         }
 
         uint32_t w = code0[pc];
         unsigned op =  OPC(w);
         
+        // per instruction trace: a raw record; the writer thread formats it
+        // (and the register deltas, from the next record)
         #ifdef TRACE
-            uint32_t before[8];
-
-            if (trace_on) memcpy(before, regs, sizeof before);
-        #endif
-
-        // per instruction trace
-        #ifdef TRACE
-        if (trace_on) {
-            if (op == 13u) {
-                unsigned A = LI_A(w);
-                uint32_t imm25 = LI_VAL(w);
-                TRACEF("[pc=%u] 0x%08x %-8s A=%u imm=%u\n",
-                pc, w, opname(op), A, imm25);
-            } else {
-                unsigned A = ABC_A(w), B = ABC_B(w), C = ABC_C(w);
-                TRACEF("[pc=%u] 0x%08x %-8s A=%u B=%u C=%u | rA=%u rB=%u rC=%u\n",
-                pc, w, opname(op), A, B, C, (unsigned)regs[A], (unsigned)regs[B], (unsigned)regs[C]);
-            }
-        }
+            if (trace_on) trace_push(TR_INSN, pc, w, regs);
         #endif
 
         // 13. Load Immediate: uses special fields
@@ -435,6 +518,9 @@ int main(int argc, char **argv) {
 
                     if ((size_t) off >= g_arr[id].len) fail_and_exit("update: offset OOB");
 
+                    if (UNLIKELY(g_watch.on) && watch_covers(id, off)) {
+                        watch_hit(pc, id, off, g_arr[id].data[off], val);
+                    }
                     g_arr[id].data[off] = val;
                     pc++;
                     break;     
@@ -457,7 +543,7 @@ int main(int argc, char **argv) {
                 /* 5: Division (unsigned): A <- B / C, /0 = Fail */
                 case 5: {
                     uint32_t denom = regs[C];
-                    if (denom == 0) { // Divde by 0 is a fail
+                    if (UNLIKELY(denom == 0)) { // Divde by 0 is a fail
                         fail_and_exit("divide by zero");
                     }
                     regs[A] = regs[B] / denom; // unsigned division
@@ -484,15 +570,13 @@ int main(int argc, char **argv) {
                     uint32_t *data = NULL;
                 
                     if (n > 0) {
-                        data = (uint32_t*)calloc((size_t)n, sizeof(uint32_t)); // zero-init
+                        data = (uint32_t*)zero_alloc((size_t)n); // zero-init
                         if (!data) fail_and_exit("alloc: OOM");
                     }
 
                     uint32_t id = id_acquire();
 
                     if (id == 0) fail_and_exit("alloc: id 0 reserved");
-                    TRACEF("    alloc -> id=%u, len=%u\n", id, (unsigned)n);
-
                     g_arr[id].data = data;
                     g_arr[id].len = n;
                     g_arr[id].active = 1;
@@ -510,9 +594,7 @@ int main(int argc, char **argv) {
                         fail_and_exit("dealloc: invalid or inactive id");
                     }
 
-                    TRACEF("    dealloc id=%u\n", id);
-
-                    free(g_arr[id].data);
+                    reclaim_free(g_arr[id].data, g_arr[id].len * sizeof(uint32_t));
                 
                     g_arr[id].data = NULL;
                     g_arr[id].len = 0;
@@ -531,7 +613,13 @@ int main(int argc, char **argv) {
                         fail_and_exit("output: value > 255");
                     }
 
-                    putchar((int)(v & 0xFF));
+                    if (g_out_ring) {
+                        if (ring_put(g_out_ring, (unsigned char)v) != 0) pipe_broken();
+                    } else if (g_out_mode != UM_OUT_STDOUT) {
+                        if (g_out_mode == UM_OUT_HASH) g_out_hash = UM_HASH_STEP(g_out_hash, v);
+                    } else {
+                        putchar_unlocked((int)(v & 0xFF));
+                    }
                     #ifdef TRACE
                         if (g_trace_enabled) fflush(stdout);
                     #endif
@@ -542,7 +630,7 @@ int main(int argc, char **argv) {
 
                 /* 11: Input: read one byte into C, EOF -> 0xFFFFFFFF */
                 case 11: {
-                    int ch = getchar();
+                    int ch = g_in_ring ? ring_get(g_in_ring) : getchar_unlocked();
                     if (ch == EOF) { 
                         regs[C] = 0xFFFFFFFFu;
                     } else {
@@ -562,38 +650,740 @@ int main(int argc, char **argv) {
                             fail_and_exit("loadprog: inactive id");
                         }
 
-                        //duplicate mem[B] into a fresh buffer
+                        //duplicate mem[B] into a fresh buffer (+1 sentinel word)
                         size_t n = g_arr[id].len;
-                        uint32_t *dup = NULL;
-                    
-                        if (n > 0) {
-                            dup = (uint32_t*)malloc(n * sizeof(uint32_t));
-                            if (!dup) fail_and_exit("loadprog: OOM");
-                            memcpy(dup, g_arr[id].data, n * sizeof(uint32_t));
-                        }
+                        uint32_t *dup = (uint32_t*)malloc((n + 1) * sizeof(uint32_t));
+
+                        if (!dup) fail_and_exit("loadprog: OOM");
+                        if (n > 0) memcpy(dup, g_arr[id].data, n * sizeof(uint32_t));
+                        dup[n] = UM_SENTINEL;
 
                         // replace array 0's data
-                        free(g_arr[0].data);
-                        g_arr[0].data = dup;
-                        g_arr[0].len = n;
-                        g_arr[0].active = 1;
+                        program_replace(dup, n);
 
                         // refresh cached program view
                         code0 = g_arr[0].data;
                         code0_len = g_arr[0].len;
                     }
+
+                    // trusted: the sentinel only covers falling off the end,
+                    // so a jump past it must be caught here
+                    if (trusted && UNLIKELY((size_t)new_pc > code0_len)) {
+                        fail_and_exit("PC out of bounds at cycle start");
+                    }
+
                     // jump: set pc = C (no increment)
                     pc = new_pc;
                     break;
                 }
 
+                /* 14/15: not UM opcodes; in trusted mode also the sentinel */
+                case 14:
+                case 15:
+                    if (trusted && (size_t)pc == code0_len) {
+                        fail_and_exit("PC out of bounds at cycle start");
+                    }
+                    fail_and_exit("invalid opcode");
+                    break;
+
                 default:
                     fail_and_exit("invalid opcode");
             }
         }
-        // per instruction register deltas
+    }
+}
+
+#ifdef TRACE
+/* the trace writer runs alongside this thread's VM */
+static int vm_run_traced(const int trusted) {
+    if (g_trace_on) trace_start();
+    int status = trusted ? vm_run(1) : vm_run(0);
+    trace_stop();
+    return status;
+}
+static int vm_run_checked(void) { return vm_run_traced(0); }
+static int vm_run_trusted(void) { return vm_run_traced(1); }
+#else
+static int vm_run_checked(void) { return vm_run(0); }
+static int vm_run_trusted(void) { return vm_run(1); }
+#endif
+
+/*------------------------------- program files -------------------------------*/
+
+/* stdin stays open for the program's `in` */
+static void close_um(FILE *f) {
+    if (f != stdin) fclose(f);
+}
+
+/* open a .um ("-" is stdin) and size it in words (exits on a bad size).
+   Pipes and other unseekable streams report 0 words: read them with
+   read_unsized. NULL if unopenable. */
+static FILE *open_um(const char *path, size_t *out_n) {
+    FILE *fPath = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    if (!fPath) {
+        fprintf(stderr, "cannot open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    /* Find file size (64-bit friendly), then rewind */
+    if (fseeko(fPath, 0, SEEK_END) != 0) {
+        if (errno == ESPIPE) {
+            *out_n = 0;
+            return fPath;
+        }
+        close_um(fPath);
+        die("fseeko failed");
+    }
+
+    off_t size = ftello(fPath);
+
+    if (size < 0) {
+        close_um(fPath);
+        die("ftello failed");
+    }
+
+    if (fseeko(fPath, 0, SEEK_SET) != 0) {
+        close_um(fPath);
+        die("fseeko rewind failed");
+    }
+
+    /* Program file size is always divisible by 4. */
+    if (size == 0) {
+        close_um(fPath);
+        die(".um file is empty");
+    }
+
+    if ((size & 3) != 0) {
+        close_um(fPath);
+        die(".um size not divisible by 4");
+    }
+
+    *out_n = (size_t)(size / 4);
+    return fPath;
+}
+
+/* read n big-endian words from f into words[0..n); -1 on a short read */
+static int read_words(FILE *f, uint32_t *words, size_t n) {
+    unsigned char buf[4096 * 4];
+
+    while (n > 0) {
+        size_t k = n < 4096 ? n : 4096;
+        if (fread(buf, 4, k, f) != k) return -1;
+        /* assemble each big-endian word (A is MSB) */
+        for (size_t i = 0; i < k; ++i) words[i] = be32_from(buf + 4 * i);
+        words += k;
+        n -= k;
+    }
+    return 0;
+}
+
+/* read a stream of unknown length to EOF into a growing buffer (nwords +
+   sentinel), swapping each chunk as it arrives */
+static uint32_t *read_unsized(FILE *f, size_t *out_n) {
+    size_t cap = 16384, nwords = 0, tail = 0; // tail: bytes of a partial word
+    uint32_t *words = (uint32_t*)malloc((cap + 1) * sizeof(uint32_t));
+    if (!words) die("out of memory");
+
+    for (;;) {
+        if (nwords + 1 >= cap) {
+            cap *= 2;
+            uint32_t *nw = (uint32_t*)realloc(words, (cap + 1) * sizeof(uint32_t));
+            if (!nw) die("out of memory");
+            words = nw;
+        }
+        // raw bytes land where their words go, then get swapped in place
+        unsigned char *raw = (unsigned char*)(words + nwords);
+        size_t got = fread(raw + tail, 1, (cap - nwords) * 4 - tail, f);
+        size_t bytes = tail + got;
+        for (size_t i = 0; i < bytes / 4; ++i) words[nwords + i] = be32_from(raw + 4 * i);
+        nwords += bytes / 4;
+        tail = bytes % 4;
+        // a partial word's bytes already sit at words + nwords
+        if (got == 0) break;
+    }
+    if (ferror(f)) die("read failed");
+
+    /* Program file size is always divisible by 4. */
+    if (nwords == 0 && tail == 0) die(".um file is empty");
+    if (tail != 0) die(".um size not divisible by 4");
+
+    words[nwords] = UM_SENTINEL;
+    *out_n = nwords;
+    return words;
+}
+
+/* read a .um ("-" is stdin) into a fresh buffer (nwords + sentinel); NULL if
+   unopenable */
+static uint32_t *read_um(const char *path, size_t *out_n) {
+    size_t nwords = 0;
+    FILE *fPath = open_um(path, &nwords);
+    if (!fPath) return NULL;
+
+    if (nwords == 0) {
+        uint32_t *words = read_unsized(fPath, out_n);
+        close_um(fPath);
+        return words;
+    }
+
+    // one extra word for the sentinel trap past the end of array 0
+    uint32_t *words = (uint32_t*)malloc((nwords + 1) * sizeof(uint32_t));
+
+    if (!words) {
+        close_um(fPath);
+        die("out of memory");
+    }
+
+    if (read_words(fPath, words, nwords) != 0) {
+        free(words);
+        close_um(fPath);
+        die("short read");
+    }
+    close_um(fPath);
+    words[nwords] = UM_SENTINEL;
+    *out_n = nwords;
+    return words;
+}
+
+/*------------------------------- streaming load -------------------------------*/
+// --stream: a loader thread reads array 0 front to back in chunks while the
+// program already runs. g_arr[0].len is the running side's view of how much
+// is in; it only grows inside stream_wait, under the same lock the loader
+// publishes with, so nothing reads words the loader may still be writing.
+
+#define STREAM_CHUNK_WORDS 16384u // words read and published at a time
+
+size_t g_stream_len = 0; // full length of array 0 while a load is in flight
+
+static struct {
+    pthread_t thread;
+    pthread_mutex_t mu;
+    pthread_cond_t cv;
+    FILE *f;
+    uint32_t *words;
+    size_t n;
+    size_t loaded; // words published so far
+    int done; // loader finished (check failed)
+    int failed; // short read
+} g_stream = { .mu = PTHREAD_MUTEX_INITIALIZER, .cv = PTHREAD_COND_INITIALIZER };
+
+static void *stream_main(void *arg) {
+    (void)arg;
+    size_t at = 0;
+    int failed = 0;
+
+    while (at < g_stream.n) {
+        size_t k = g_stream.n - at < STREAM_CHUNK_WORDS ? g_stream.n - at : STREAM_CHUNK_WORDS;
+        if (read_words(g_stream.f, g_stream.words + at, k) != 0) {
+            failed = 1;
+            break;
+        }
+        at += k;
+        pthread_mutex_lock(&g_stream.mu);
+        g_stream.loaded = at;
+        pthread_cond_broadcast(&g_stream.cv);
+        pthread_mutex_unlock(&g_stream.mu);
+    }
+
+    close_um(g_stream.f);
+    pthread_mutex_lock(&g_stream.mu);
+    g_stream.done = 1;
+    g_stream.failed = failed;
+    pthread_cond_broadcast(&g_stream.cv);
+    pthread_mutex_unlock(&g_stream.mu);
+    return NULL;
+}
+
+/* array 0 (already booted with its full buffer and sentinel) is filled from
+   f by the loader thread; it starts out with 0 words loaded */
+static void stream_start(FILE *f, size_t nwords) {
+    g_stream.f = f;
+    g_stream.words = g_arr[0].data;
+    g_stream.n = nwords;
+    g_stream_len = nwords;
+    g_arr[0].len = 0;
+    if (pthread_create(&g_stream.thread, NULL, stream_main, NULL) != 0) {
+        // no thread: load in place instead
+        stream_main(NULL);
+        g_arr[0].len = nwords;
+        g_stream_len = 0;
+        if (g_stream.failed) die("short read");
+    }
+}
+
+size_t stream_wait(size_t pc) {
+    if (g_stream_len == 0) return g_arr[0].len;
+
+    pthread_mutex_lock(&g_stream.mu);
+    while (g_stream.loaded <= pc && !g_stream.done) pthread_cond_wait(&g_stream.cv, &g_stream.mu);
+    size_t loaded = g_stream.loaded;
+    int done = g_stream.done, failed = g_stream.failed;
+    pthread_mutex_unlock(&g_stream.mu);
+
+    g_arr[0].len = loaded;
+    if (done) {
+        pthread_join(g_stream.thread, NULL);
+        g_stream_len = 0;
+        if (failed) die("short read");
+    }
+    return loaded;
+}
+
+int stream_reach(uint32_t id, size_t off) {
+    if (id != 0 || off >= g_stream_len) return 0;
+    return stream_wait(off) > off;
+}
+
+void stream_finish(void) {
+    if (g_stream_len) stream_wait(g_stream_len);
+}
+
+/* .umc sibling of a .um path (path + "c") or .um sibling of a .umc path */
+static char *sibling_path(const char *path, int to_umc) {
+    size_t n = strlen(path);
+    char *p = (char*)malloc(n + 2);
+    if (!p) die("out of memory");
+    memcpy(p, path, n + 1);
+    if (to_umc) {
+        p[n] = 'c';
+        p[n + 1] = '\0';
+    } else {
+        p[n - 1] = '\0'; // drop the trailing 'c'
+    }
+    return p;
+}
+
+static int has_suffix(const char *s, const char *suf) {
+    size_t n = strlen(s), k = strlen(suf);
+    return n >= k && strcmp(s + n - k, suf) == 0;
+}
+
+/* load the program into array-0 form (nwords + sentinel).
+   - X.umc is mapped as is, unless X.um exists and no longer matches it
+     (then X.um is loaded instead).
+   - X.um with make_umc uses a fresh X.umc if there is one, and otherwise
+     loads X.um and writes X.umc for the next run.
+   - X.um with shm_dir does the same with a shared image in shm_dir, named
+     after X.um's identity, so concurrent runs map one copy. One that is not
+     ours alone is never mapped (umc_map_shared); it is replaced if the
+     directory lets us.
+   When the words live in a mapping, g_arr0_umc holds it and *sel points at
+   its operand selectors. Returns NULL if the file cannot be opened. */
+static uint32_t *load_image(const char *path, int make_umc, const char *shm_dir,
+                            size_t *out_n, const uint16_t **sel) {
+    *sel = NULL;
+    int named = has_suffix(path, ".umc");
+    // stdin has no .umc/.um siblings to map or compare against
+    if (strcmp(path, "-") == 0 || (!named && !make_umc && !shm_dir)) return read_um(path, out_n);
+
+    char *um = named ? sibling_path(path, 0) : (char*)path;
+    struct stat st;
+    int have_um = stat(um, &st) == 0;
+    char *umc = (char*)path;
+    char shm_path[4096];
+
+    if (!named && shm_dir) {
+        if (!have_um) return read_um(um, out_n); // reports the error
+        if (umc_shm_path(shm_path, sizeof shm_path, shm_dir, &st) != 0) die("--shm: path too long");
+        umc = shm_path;
+    } else if (!named) {
+        umc = sibling_path(path, 1);
+    }
+    uint32_t *words = NULL;
+
+    int rc = umc == shm_path ? umc_map_shared(&g_arr0_umc, umc, &st)
+                             : umc_map(&g_arr0_umc, umc, have_um ? &st : NULL);
+    if (rc == 0) {
+        if (g_arr0_umc.nwords == 0) die(".umc program is empty");
+        words = g_arr0_umc.words;
+        *out_n = g_arr0_umc.nwords;
+        *sel = g_arr0_umc.sel;
+    } else if (named && !have_um) {
+        fprintf(stderr, "cannot load %s: %s\n", umc,
+                access(umc, R_OK) != 0 ? strerror(errno) : "not a valid .umc file");
+    } else {
+        if (named) fprintf(stderr, "note: %s is %s; loading %s\n", umc, rc > 0 ? "stale" : "unusable", um);
+        words = read_um(um, out_n);
+        // write the image for the next run; a shared one is mapped right away
+        // so this process uses the same pages as the ones that follow
+        if (words && umc_write(umc, words, *out_n, &st) != 0) {
+            fprintf(stderr, "warning: cannot write %s\n", umc);
+        } else if (words && umc == shm_path && umc_map(&g_arr0_umc, umc, &st) == 0) {
+            free(words);
+            words = g_arr0_umc.words;
+            *sel = g_arr0_umc.sel;
+        }
+    }
+
+    if (named) free(um);
+    else if (umc != shm_path) free(umc);
+    return words;
+}
+
+/*-------------------------------- pipelines ---------------------------------*/
+// --pipe a.um b.um c.um runs `a | b | c` in one process: one VM per thread
+// (all VM state is UM_TLS), each `out` feeding the next stage's `in` through
+// an SPSC byte ring (ring.h) instead of a kernel pipe.
+//   - stdin (or --input) and stdout are pumped into the first ring and out
+//     of the last one in 64 KiB blocks, so no stage goes through stdio
+//     (which locks on every call once there are threads).
+//   - A stage that halts closes its output ring (the next `in` sees EOF once
+//     it is drained) and abandons its input ring.
+//   - `out` into an abandoned ring ends that stage quietly, like SIGPIPE.
+//   - A spec failure in any stage still ends the whole process.
+
+typedef struct {
+    const char *path;
+    int threaded, trusted, make_umc;
+    const char *shm_dir;
+    EngineConfig ecfg;
+    UMRing *in, *out;
+    pthread_t thread;
+    int status;
+} PipeStage;
+
+/* this thread's stage is done: EOF downstream, no more reads upstream */
+static void stage_end(void) {
+    if (g_out_ring) ring_close(g_out_ring);
+    if (g_in_ring) ring_abandon(g_in_ring);
+}
+
+void pipe_broken(void) {
+    #ifdef TRACE
+        trace_stop();
+    #endif
+    engine_release();
+    arrays_destroy();
+    stage_end();
+    pthread_exit(NULL);
+}
+
+static void *stage_main(void *arg) {
+    PipeStage *st = (PipeStage*)arg;
+    g_stage = st->path;
+    g_in_ring = st->in;
+    g_out_ring = st->out;
+
+    size_t nwords = 0;
+    const uint16_t *sel = NULL;
+    uint32_t *words = load_image(st->path, st->make_umc, st->shm_dir, &nwords, &sel);
+    if (!words) exit(1);
+    arrays_boot(words, nwords);
+
+    if (st->trusted) {
+        size_t bad = verify_entry_path(words, nwords);
+        if (bad != nwords) {
+            fprintf(stderr, "error: %s: --trusted: invalid opcode %u at pc=%zu\n",
+                    st->path, OPC(words[bad]), bad);
+            exit(1);
+        }
+    }
+
+    st->ecfg.sel = sel;
+    if (st->threaded) st->status = engine_run(&st->ecfg);
+    else st->status = st->trusted ? vm_run_trusted() : vm_run_checked();
+    stage_end();
+    return NULL;
+}
+
+#define PIPE_BLOCK 65536u // bytes per stdin read / stdout write
+
+/* the first ring is shared by the stdin thread and pipe_run: the last one
+   to let go of it frees it */
+static atomic_int g_stdin_ring_refs;
+
+static void stdin_ring_release(UMRing *r) {
+    if (atomic_fetch_sub(&g_stdin_ring_refs, 1) == 1) ring_free(r);
+}
+
+/* stdin -> first ring (detached: it may sit in read() until the process ends) */
+static void *pipe_stdin_main(void *arg) {
+    UMRing *r = (UMRing*)arg;
+    unsigned char *buf = (unsigned char*)malloc(PIPE_BLOCK);
+    int fd = fileno(stdin);
+
+    for (;;) {
+        ssize_t got = buf ? read(fd, buf, PIPE_BLOCK) : 0;
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0 || ring_write(r, buf, (size_t)got) != 0) break;
+    }
+    ring_close(r);
+    free(buf);
+    stdin_ring_release(r);
+    return NULL;
+}
+
+/* last ring -> stdout (or --output's sink), until the last stage halts */
+static void pipe_stdout(UMRing *r) {
+    unsigned char *buf = (unsigned char*)malloc(PIPE_BLOCK);
+    if (!buf) die("out of memory");
+    size_t n;
+
+    while ((n = ring_read(r, buf, PIPE_BLOCK)) > 0) {
+        if (g_out_mode != UM_OUT_STDOUT) {
+            if (g_out_mode == UM_OUT_HASH) {
+                for (size_t i = 0; i < n; ++i) g_out_hash = UM_HASH_STEP(g_out_hash, buf[i]);
+            }
+            continue;
+        }
+        for (size_t at = 0; at < n;) {
+            ssize_t put = write(STDOUT_FILENO, buf + at, n - at);
+            if (put < 0 && errno == EINTR) continue;
+            if (put < 0) { // nobody reads our output any more
+                ring_abandon(r);
+                free(buf);
+                return;
+            }
+            at += (size_t)put;
+        }
+    }
+    free(buf);
+}
+
+/* run paths[0] | paths[1] | ... with the stage settings in proto */
+static int pipe_run(char **paths, int n, const PipeStage *proto) {
+    PipeStage *st = (PipeStage*)calloc((size_t)n, sizeof *st);
+    UMRing **rings = (UMRing**)calloc((size_t)n + 1, sizeof *rings); // rings[i] feeds stage i
+    if (!st || !rings) die("out of memory");
+    for (int i = 0; i <= n; ++i) {
+        if (!(rings[i] = ring_new())) die("out of memory");
+    }
+
+    for (int i = 0; i < n; ++i) {
+        st[i] = *proto;
+        st[i].path = paths[i];
+        st[i].in = rings[i];
+        st[i].out = rings[i + 1];
+        if (pthread_create(&st[i].thread, NULL, stage_main, &st[i]) != 0) die("cannot start pipeline thread");
+    }
+    pthread_t in_thread;
+    atomic_store(&g_stdin_ring_refs, 2);
+    if (pthread_create(&in_thread, NULL, pipe_stdin_main, rings[0]) != 0) die("cannot start pipeline thread");
+    pthread_detach(in_thread);
+
+    pipe_stdout(rings[n]);
+
+    int status = 0;
+    for (int i = 0; i < n; ++i) {
+        pthread_join(st[i].thread, NULL);
+        if (st[i].status) status = st[i].status;
+    }
+    stdin_ring_release(rings[0]);
+    for (int i = 1; i <= n; ++i) ring_free(rings[i]);
+    free(rings);
+    free(st);
+    return status;
+}
+
+/* --watch id:offset[:len] (decimal or 0x hex); 0, or -1 if malformed */
+static int parse_watch(const char *spec) {
+    uint32_t v[3] = { 0, 0, 1 };
+    const char *p = spec;
+    int n = 0;
+    for (; n < 3; ++n) {
+        char *end;
+        errno = 0;
+        unsigned long x = strtoul(p, &end, 0);
+        if (end == p || errno || x > UINT32_MAX || *p == '-') return -1;
+        v[n] = (uint32_t)x;
+        p = end;
+        if (*p != ':') break;
+        ++p;
+    }
+    if (*p || n < 1 || n > 2 || v[2] == 0) return -1;
+    g_watch.on = 1;
+    g_watch.id = v[0];
+    g_watch.off = v[1];
+    g_watch.len = v[2];
+    return 0;
+}
+
+/* --output=hash: the program halted, report what it printed */
+static void print_out_hash(void) {
+    if (g_out_mode == UM_OUT_HASH) printf("%016" PRIx64 "\n", g_out_hash);
+}
+
+/*------------------------------------ main -----------------------------------*/
+int main(int argc, char **argv) {
+    parse_trace_flag(&argc, &argv);
+    int trusted = take_flag(&argc, &argv, "--trusted");
+    const char *engine = take_opt(&argc, &argv, "--engine");
+    EngineConfig ecfg = { .jit = !take_flag(&argc, &argv, "--no-jit") };
+    ecfg.ret_stack = take_flag(&argc, &argv, "--ret-stack");
+    ecfg.cache_dir = take_opt(&argc, &argv, "--code-cache");
+    ecfg.stats = take_flag(&argc, &argv, "--stats");
+    int make_umc = take_flag(&argc, &argv, "--umc");
+    int stream = take_flag(&argc, &argv, "--stream");
+    const char *input = take_opt(&argc, &argv, "--input");
+    const char *output = take_opt(&argc, &argv, "--output");
+    const char *watch = take_opt(&argc, &argv, "--watch");
+    const char *breaks = take_opt(&argc, &argv, "--break");
+    const char *break_cmds = take_opt(&argc, &argv, "--break-cmds");
+    const char *zero = take_opt(&argc, &argv, "--zero");
+    // --pipe, or installed as um-pipe
+    const char *base = strrchr(argv[0], '/');
+    int pipeline = take_flag(&argc, &argv, "--pipe") ||
+                   strcmp(base ? base + 1 : argv[0], "um-pipe") == 0;
+    const char *shm_dir = NULL;
+    if (take_flag(&argc, &argv, "--shm")) {
+        shm_dir = getenv("UM_SHM_DIR");
+        if (!shm_dir || !*shm_dir) shm_dir = "/dev/shm";
+    }
+
+    #ifdef TRACE
+        g_trace_on = g_trace_enabled;
+        if (g_trace_on) setvbuf(stderr, NULL, _IONBF, 0);
+    #endif
+
+    int argi = 1;
+
+    // -h / --help (accept anywhere for convenience)
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            print_help(argv[0]);
+            return 0;
+        }
+    }
+
+    #ifdef TRACE
+    if (g_trace_on) {
+        const char *lim = getenv("UM_TRACE_LIMIT");
+        if (lim && *lim) g_trace_limit = (unsigned)strtoul(lim, NULL, 0);
+    }
+    #endif
+
+    int threaded = 1;
+    if (engine && strcmp(engine, "switch") == 0) {
+        threaded = 0;
+    } else if (engine && strcmp(engine, "threaded") != 0) {
+        fprintf(stderr, "unknown engine '%s' (expected threaded or switch)\n", engine);
+        return 2;
+    }
+
+    if (output && strcmp(output, "null") == 0) {
+        g_out_mode = UM_OUT_NULL;
+    } else if (output && strcmp(output, "hash") == 0) {
+        g_out_mode = UM_OUT_HASH;
+    } else if (output && strcmp(output, "stdout") != 0) {
+        fprintf(stderr, "unknown output '%s' (expected stdout, null or hash)\n", output);
+        return 2;
+    }
+
+    if (zero && strcmp(zero, "parallel") == 0) {
+        g_zero_mode = UM_ZERO_PARALLEL;
+    } else if (zero && strcmp(zero, "calloc") != 0) {
+        fprintf(stderr, "unknown zero mode '%s' (expected calloc or parallel)\n", zero);
+        return 2;
+    }
+
+    if (watch && parse_watch(watch) != 0) {
+        fprintf(stderr, "bad --watch '%s' (expected id:offset[:len])\n", watch);
+        return 2;
+    }
+
+    #ifdef TRACE
+        // the per-instruction trace lives in the switch loop
+        if (g_trace_on) threaded = 0;
+    #endif
+
+    // breakpoints live in the threaded engine's decoded stream
+    if ((breaks || break_cmds) && (!threaded || pipeline)) {
+        fprintf(stderr, "--break needs the threaded engine and a single program\n");
+        return 2;
+    }
+    if ((breaks || break_cmds) && debug_open(breaks ? breaks : "", break_cmds) != 0) return 2;
+
+    if (pipeline) {
+        if (argc - argi < 1) {
+            fprintf(stderr, "usage: %s [options] --pipe <a.um> <b.um> ...\n", argv[0]);
+            return 2;
+        }
+        for (int i = argi; i < argc; ++i) {
+            if (strcmp(argv[i], "-") == 0) {
+                fprintf(stderr, "--pipe: stdin feeds the first stage; programs must be files\n");
+                return 2;
+            }
+        }
         #ifdef TRACE
-            if (trace_on) dump_reg_changes(before, regs);
+        if (g_trace_path) { // one file per writer
+            fprintf(stderr, "--pipe: use --trace (text) rather than --trace=FILE\n");
+            return 2;
+        }
         #endif
+        if (input && !freopen(input, "rb", stdin)) {
+            fprintf(stderr, "cannot open %s: %s\n", input, strerror(errno));
+            return 1;
+        }
+        PipeStage proto = {
+            .threaded = threaded, .trusted = trusted, .make_umc = make_umc,
+            .shm_dir = shm_dir, .ecfg = ecfg,
+        };
+        int status = pipe_run(argv + argi, argc - argi, &proto);
+        if (status == 0) print_out_hash();
+        return status;
     }
-}
\ No newline at end of file
+
+    // exactly one positional argument is required at this point
+    if (argc - argi != 1) {
+        fprintf(stderr, "usage: %s [options] <program.um>\n"
+                        "try '%s --help' for more info\n", argv[0], argv[0]);
+        return 2;
+    }
+    const char *path = argv[argi];
+
+    /*--------------------------- read program into memory -------------------*/
+
+    size_t nwords = 0;
+    const uint16_t *sel = NULL;
+    FILE *streamf = NULL;
+    uint32_t *words = NULL;
+
+    // --stream covers plain .um files on the threaded engine; the switch
+    // loop and --trusted want the whole program before the first cycle
+    // (and a stream needs a known length; stdin may also feed `in`)
+    if (stream && threaded && !trusted && !make_umc && !shm_dir && !has_suffix(path, ".umc") &&
+        strcmp(path, "-") != 0) {
+        streamf = open_um(path, &nwords);
+        if (!streamf) return 1;
+        if (nwords == 0) { // a pipe: load it whole
+            words = read_unsized(streamf, &nwords);
+            close_um(streamf);
+            streamf = NULL;
+        } else {
+            words = (uint32_t*)malloc((nwords + 1) * sizeof(uint32_t));
+            if (!words) die("out of memory");
+            words[nwords] = UM_SENTINEL;
+        }
+    } else {
+        words = load_image(path, make_umc, shm_dir, &nwords, &sel);
+        if (!words) return 1;
+    }
+    ecfg.sel = sel;
+
+    // boot machine arrays: id 0 = program
+    arrays_boot(words, nwords);
+    if (streamf) stream_start(streamf, nwords);
+
+    // --input: the program's `in` reads FILE instead of stdin (which may
+    // have carried the program itself)
+    if (input && !freopen(input, "rb", stdin)) {
+        fprintf(stderr, "cannot open %s: %s\n", input, strerror(errno));
+        arrays_destroy();
+        return 1;
+    }
+
+    if (trusted) {
+        size_t bad = verify_entry_path(words, nwords);
+        if (bad != nwords) {
+            fprintf(stderr, "error: --trusted: invalid opcode %u at pc=%zu\n",
+                    OPC(words[bad]), bad);
+            arrays_destroy();
+            return 1;
+        }
+    }
+
+    int status;
+    if (threaded) status = engine_run(&ecfg);
+    else status = trusted ? vm_run_trusted() : vm_run_checked();
+    if (status == 0) print_out_hash();
+    return status;
+}
@@ -0,0 +1,121 @@
+// LZ77 block compressor (binary traces)
+// -----------------------------------------------------------------------------
+// A block is a series of sequences, each:
+//
+//   token       high nibble: literal count, low nibble: match length - 4
+//               (15 in either: more length bytes follow, 255 = keep adding)
+//   [lengths]   literal count extension
+//   literals
+//   offset      2 bytes little-endian, 1..65535 back from the current output
+//   [lengths]   match length extension
+//
+// The last sequence of a block carries literals only (the block ends right
+// after them). Matches are found greedily through a 4096-entry table of the
+// last position of each 4-byte hash, so compressing is a few loads and
+// compares per byte.
+// -----------------------------------------------------------------------------
+#include <string.h>
+
+#include "lz.h"
+
+#define LZ_MIN_MATCH 4u
+#define LZ_HASH_BITS 12
+#define LZ_MAX_OFFSET 65535u
+
+static inline uint32_t load32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof v);
+    return v;
+}
+
+static inline uint32_t lz_hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* length nibble + extension bytes for len >= 15 */
+static uint8_t *put_len(uint8_t *op, size_t len) {
+    for (len -= 15; len >= 255; len -= 255) *op++ = 255;
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+static uint8_t *put_sequence(uint8_t *op, const uint8_t *lit, size_t nlit, size_t off, size_t mlen) {
+    uint8_t *token = op++;
+    *token = (uint8_t)((nlit < 15 ? nlit : 15) << 4);
+    if (nlit >= 15) op = put_len(op, nlit);
+    memcpy(op, lit, nlit);
+    op += nlit;
+    if (mlen == 0) return op; // final literals
+    *op++ = (uint8_t)(off & 0xFF);
+    *op++ = (uint8_t)(off >> 8);
+    mlen -= LZ_MIN_MATCH;
+    *token |= (uint8_t)(mlen < 15 ? mlen : 15);
+    if (mlen >= 15) op = put_len(op, mlen);
+    return op;
+}
+
+size_t lz_compress(const uint8_t *src, size_t n, uint8_t *dst) {
+    uint32_t table[1u << LZ_HASH_BITS]; // position + 1 (0: empty)
+    memset(table, 0, sizeof table);
+    uint8_t *op = dst;
+    size_t anchor = 0, i = 0;
+
+    while (n >= LZ_MIN_MATCH && i <= n - LZ_MIN_MATCH) {
+        uint32_t v = load32(src + i);
+        uint32_t *slot = &table[lz_hash(v)];
+        size_t cand = *slot;
+        *slot = (uint32_t)(i + 1);
+        if (cand == 0 || i - (cand - 1) > LZ_MAX_OFFSET || load32(src + cand - 1) != v) {
+            ++i;
+            continue;
+        }
+        cand -= 1;
+        size_t len = LZ_MIN_MATCH;
+        while (i + len < n && src[cand + len] == src[i + len]) ++len;
+
+        op = put_sequence(op, src + anchor, i - anchor, i - cand, len);
+        i += len;
+        anchor = i;
+    }
+    return (size_t)(put_sequence(op, src + anchor, n - anchor, 0, 0) - dst);
+}
+
+/* read a length extension; 0 on running off the input */
+static int get_len(const uint8_t **ip, const uint8_t *end, size_t *len) {
+    uint8_t b;
+    do {
+        if (*ip >= end) return 0;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 1;
+}
+
+size_t lz_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap) {
+    const uint8_t *ip = src, *end = src + n;
+    size_t o = 0;
+
+    while (ip < end) {
+        uint8_t token = *ip++;
+        size_t nlit = token >> 4;
+        if (nlit == 15 && !get_len(&ip, end, &nlit)) return (size_t)-1;
+        if (nlit > (size_t)(end - ip) || nlit > cap - o) return (size_t)-1;
+        memcpy(dst + o, ip, nlit);
+        ip += nlit;
+        o += nlit;
+        if (ip == end) break; // final literals
+
+        if (end - ip < 2) return (size_t)-1;
+        size_t off = (size_t)ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        size_t mlen = token & 15u;
+        if (mlen == 15 && !get_len(&ip, end, &mlen)) return (size_t)-1;
+        mlen += LZ_MIN_MATCH;
+        if (off == 0 || off > o || mlen > cap - o) return (size_t)-1;
+        // byte by byte: a match may overlap the bytes it produces
+        const uint8_t *from = dst + o - off;
+        for (size_t k = 0; k < mlen; ++k) dst[o + k] = from[k];
+        o += mlen;
+    }
+    return o;
+}
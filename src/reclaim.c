@@ -0,0 +1,111 @@
+// UM background reclaimer (large dealloc / loadprog frees)
+// -----------------------------------------------------------------------------
+// free() of a big array ends in munmap, which costs time for every page the
+// program touched and stalls the VM in the middle of a `dealloc` or of the
+// `loadprog` that drops the old array 0. Blocks of RECLAIM_MIN_BYTES and up
+// are queued for one reclaimer thread instead (started on first use). The
+// caller releases the array id as before, so ids stay reusable at once; only
+// the memory is returned later.
+//
+// The queue is bounded in entries and in bytes not yet returned: a program
+// that frees faster than the reclaimer keeps up frees the excess inline, so
+// memory held back stays bounded. One reclaimer serves every --pipe stage.
+// The thread is detached; blocks still queued at exit go with the process.
+//
+// Until it is freed, a queued block can be taken back for an `alloc` of the
+// same size (reclaim_take, --zero=parallel in zero.c): its pages are already
+// mapped, so zeroing them again beats fresh demand-zero pages.
+// -----------------------------------------------------------------------------
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "reclaim.h"
+
+#define RECLAIM_QUEUE 64u // blocks
+#define RECLAIM_MAX_PENDING ((size_t)1 << 30) // bytes queued, not yet freed
+#define RECLAIM_NAP_NS 2000000L // reclaimer's longest sleep with work queued (2 ms)
+
+static pthread_mutex_t g_rc_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_rc_cv = PTHREAD_COND_INITIALIZER;
+static struct {
+    void *p;
+    size_t bytes;
+} g_rc_q[RECLAIM_QUEUE];
+static size_t g_rc_head = 0, g_rc_count = 0;
+static size_t g_rc_pending = 0; // bytes in the queue or being freed
+static int g_rc_state = 0; // 0: not started, 1: running, -1: no thread
+
+static void *reclaimer_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&g_rc_lock);
+    for (;;) {
+        while (g_rc_count == 0) pthread_cond_wait(&g_rc_cv, &g_rc_lock);
+        if (g_rc_count < RECLAIM_QUEUE / 2) {
+            // let a few gather: see reclaim_free
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += RECLAIM_NAP_NS;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&g_rc_cv, &g_rc_lock, &ts);
+            if (g_rc_count == 0) continue; // all taken back meanwhile
+        }
+        void *p = g_rc_q[g_rc_head].p;
+        size_t bytes = g_rc_q[g_rc_head].bytes;
+        g_rc_head = (g_rc_head + 1) % RECLAIM_QUEUE;
+        g_rc_count--;
+        pthread_mutex_unlock(&g_rc_lock);
+
+        free(p);
+
+        pthread_mutex_lock(&g_rc_lock);
+        g_rc_pending -= bytes;
+    }
+    return NULL;
+}
+
+void reclaim_free(void *p, size_t bytes) {
+    if (!p || bytes < RECLAIM_MIN_BYTES) {
+        free(p);
+        return;
+    }
+    pthread_mutex_lock(&g_rc_lock);
+    if (g_rc_state == 0) {
+        pthread_t t;
+        g_rc_state = pthread_create(&t, NULL, reclaimer_main, NULL) == 0 ? 1 : -1;
+        if (g_rc_state == 1) pthread_detach(t);
+    }
+    if (g_rc_state < 0 || g_rc_count == RECLAIM_QUEUE || g_rc_pending + bytes > RECLAIM_MAX_PENDING) {
+        pthread_mutex_unlock(&g_rc_lock);
+        free(p); // reclaimer behind (or unavailable): do it here
+        return;
+    }
+    g_rc_q[(g_rc_head + g_rc_count) % RECLAIM_QUEUE].p = p;
+    g_rc_q[(g_rc_head + g_rc_count) % RECLAIM_QUEUE].bytes = bytes;
+    g_rc_count++;
+    g_rc_pending += bytes;
+    // wake an idle reclaimer, or a napping one once the queue fills up
+    if (g_rc_count == 1 || g_rc_count == RECLAIM_QUEUE / 2) pthread_cond_signal(&g_rc_cv);
+    pthread_mutex_unlock(&g_rc_lock);
+}
+
+void *reclaim_take(size_t bytes) {
+    void *p = NULL;
+    pthread_mutex_lock(&g_rc_lock);
+    for (size_t i = 0; i < g_rc_count; ++i) {
+        size_t k = (g_rc_head + i) % RECLAIM_QUEUE;
+        if (g_rc_q[k].bytes != bytes) continue;
+        p = g_rc_q[k].p;
+        // the newest entry fills the hole (order does not matter)
+        size_t last = (g_rc_head + g_rc_count - 1) % RECLAIM_QUEUE;
+        g_rc_q[k] = g_rc_q[last];
+        g_rc_count--;
+        g_rc_pending -= bytes;
+        break;
+    }
+    pthread_mutex_unlock(&g_rc_lock);
+    return p;
+}
@@ -0,0 +1,159 @@
+// UM pipeline byte ring (loader --pipe)
+// -----------------------------------------------------------------------------
+// One producer thread (a stage's `out`) and one consumer thread (the next
+// stage's `in`). head and tail count bytes ever written/read, so
+// head - tail is the fill level and the buffer index is the count mod size.
+//
+// Sleeping: a side that finds the ring full/empty yields a few times, then
+// takes the lock, raises its want_* flag, re-checks and waits. The other side
+// stores its index (release) and then reads the flag (relaxed) and wakes the
+// sleeper under the same lock. Without a store-load fence on every byte
+// (which cost as much as the rest of a UM `out`/`in` together) the peer can
+// still miss a flag raised at that very moment, so sleeps are bounded
+// (RING_NAP_NS): a missed wake-up costs at most one nap, never a hang.
+//
+// A full ring wakes its producer only once half of it is free again, so a
+// slow consumer does not cost a context switch per byte.
+// -----------------------------------------------------------------------------
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ring.h"
+
+#define RING_SPINS 16 // yields before sleeping
+#define RING_NAP_NS 1000000L // longest sleep between re-checks (1 ms)
+
+/* wait on r->cv (locked) for at most RING_NAP_NS */
+static void ring_nap(UMRing *r) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += RING_NAP_NS;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec += 1;
+        ts.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(&r->cv, &r->mu, &ts);
+}
+
+UMRing *ring_new(void) {
+    UMRing *r = (UMRing*)aligned_alloc(64, sizeof(UMRing));
+    if (!r) return NULL;
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    r->tail_seen = r->head_seen = 0;
+    atomic_init(&r->want_space, 0);
+    atomic_init(&r->want_data, 0);
+    atomic_init(&r->closed, 0);
+    atomic_init(&r->abandoned, 0);
+    pthread_mutex_init(&r->mu, NULL);
+    pthread_cond_init(&r->cv, NULL);
+    return r;
+}
+
+void ring_free(UMRing *r) {
+    if (!r) return;
+    pthread_mutex_destroy(&r->mu);
+    pthread_cond_destroy(&r->cv);
+    free(r);
+}
+
+void ring_wake(UMRing *r) {
+    pthread_mutex_lock(&r->mu);
+    pthread_cond_broadcast(&r->cv);
+    pthread_mutex_unlock(&r->mu);
+}
+
+void ring_close(UMRing *r) {
+    atomic_store(&r->closed, 1);
+    ring_wake(r);
+}
+
+void ring_abandon(UMRing *r) {
+    atomic_store(&r->abandoned, 1);
+    ring_wake(r);
+}
+
+/* producer: ring is full */
+int ring_wait_space(UMRing *r) {
+    size_t h = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+    for (int spin = 0;; ++spin) {
+        r->tail_seen = atomic_load(&r->tail);
+        if (h - r->tail_seen < UM_RING_SIZE) return 0;
+        if (atomic_load(&r->abandoned)) return -1;
+        if (spin < RING_SPINS) {
+            sched_yield();
+            continue;
+        }
+
+        pthread_mutex_lock(&r->mu);
+        atomic_store(&r->want_space, 1);
+        while (h - atomic_load(&r->tail) > UM_RING_SIZE / 2 && !atomic_load(&r->abandoned)) {
+            ring_nap(r);
+        }
+        atomic_store(&r->want_space, 0);
+        pthread_mutex_unlock(&r->mu);
+    }
+}
+
+/* consumer: ring is empty */
+int ring_wait_data(UMRing *r) {
+    size_t t = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+    for (int spin = 0;; ++spin) {
+        // closed is set after the last head store: read it first
+        int closed = atomic_load(&r->closed);
+        r->head_seen = atomic_load(&r->head);
+        if (r->head_seen != t) return 0;
+        if (closed) return -1;
+        if (spin < RING_SPINS) {
+            sched_yield();
+            continue;
+        }
+
+        pthread_mutex_lock(&r->mu);
+        atomic_store(&r->want_data, 1);
+        while (atomic_load(&r->head) == t && !atomic_load(&r->closed)) {
+            ring_nap(r);
+        }
+        atomic_store(&r->want_data, 0);
+        pthread_mutex_unlock(&r->mu);
+    }
+}
+
+int ring_write(UMRing *r, const unsigned char *src, size_t n) {
+    while (n > 0) {
+        size_t h = atomic_load_explicit(&r->head, memory_order_relaxed);
+        if (h - r->tail_seen == UM_RING_SIZE && ring_wait_space(r) != 0) return -1;
+
+        size_t at = h & (UM_RING_SIZE - 1);
+        size_t k = UM_RING_SIZE - (h - r->tail_seen);
+        if (k > UM_RING_SIZE - at) k = UM_RING_SIZE - at; // up to the wrap
+        if (k > n) k = n;
+        memcpy(r->buf + at, src, k);
+        atomic_store_explicit(&r->head, h + k, memory_order_release);
+        if (atomic_load_explicit(&r->want_data, memory_order_relaxed)) ring_wake(r);
+        src += k;
+        n -= k;
+    }
+    return 0;
+}
+
+size_t ring_read(UMRing *r, unsigned char *dst, size_t max) {
+    size_t t = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    if (t == r->head_seen && ring_wait_data(r) != 0) return 0;
+
+    size_t at = t & (UM_RING_SIZE - 1);
+    size_t k = r->head_seen - t;
+    if (k > UM_RING_SIZE - at) k = UM_RING_SIZE - at;
+    if (k > max) k = max;
+    memcpy(dst, r->buf + at, k);
+    atomic_store_explicit(&r->tail, t + k, memory_order_release);
+    if (atomic_load_explicit(&r->want_space, memory_order_relaxed) &&
+        atomic_load_explicit(&r->head, memory_order_relaxed) - (t + k) <= UM_RING_SIZE / 2) {
+        ring_wake(r);
+    }
+    return k;
+}
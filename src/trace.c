@@ -0,0 +1,130 @@
+// UM instruction trace writer (--trace, debug builds)
+// -----------------------------------------------------------------------------
+// The VM thread pushes one raw TraceRec per instruction into an SPSC ring
+// (trace.h); a writer thread per traced VM drains it and either formats the
+// familiar text trace to stderr or, with --trace=FILE, writes a compressed
+// binary .umt (tracefile.c). Formatting, compression and writes therefore
+// never run on the VM thread.
+//
+// Backpressure (UM_TRACE_POLICY):
+//   - block (default): a full ring makes the VM wait for the writer, so the
+//     trace is complete.
+//   - drop: a full ring loses the record instead. The next record carries
+//     the count, the writer marks the gap, and trace_stop reports the total.
+//
+// Neither side sleeps on a condition variable: the VM polls only when the
+// ring is full, and the idle writer naps briefly between polls, so pushing
+// a record needs no flag check or wake-up.
+// -----------------------------------------------------------------------------
+#ifdef TRACE
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "trace.h"
+
+#define TRACE_SPINS 16 // yields before napping
+#define TRACE_NAP_NS 100000L // 0.1 ms
+
+const char *g_trace_path = NULL;
+UM_TLS TraceRing *g_trace_ring = NULL;
+static UM_TLS pthread_t g_writer;
+
+static void nap(void) {
+    struct timespec ts = { 0, TRACE_NAP_NS };
+    nanosleep(&ts, NULL);
+}
+
+/*--------------------------------- writer ------------------------------------*/
+
+static void *writer_main(void *arg) {
+    TraceRing *q = (TraceRing*)arg;
+    TraceText *text = NULL;
+    UMTWriter *bin = NULL;
+    if (g_trace_path) {
+        if (!(bin = umt_create(g_trace_path))) {
+            fprintf(stderr, "trace: cannot write %s: %s\n", g_trace_path, strerror(errno));
+            exit(1);
+        }
+    } else if (!(text = tt_new(stderr))) {
+        fprintf(stderr, "trace: out of memory\n");
+        exit(1);
+    }
+    size_t t = 0;
+    int err = 0;
+
+    for (int idle = 0;;) {
+        // closed is set after the last head store: read it first
+        int closed = atomic_load_explicit(&q->closed, memory_order_acquire);
+        size_t h = atomic_load_explicit(&q->head, memory_order_acquire);
+        if (h == t) {
+            if (text) tt_flush(text);
+            if (closed) break;
+            if (idle++ < TRACE_SPINS) sched_yield();
+            else nap();
+            continue;
+        }
+        idle = 0;
+        for (; t != h; ++t) {
+            const TraceRec *e = &q->buf[t & (TRACE_RING_RECS - 1)];
+            if (text) tt_record(text, e);
+            else err |= umt_record(bin, e);
+        }
+        atomic_store_explicit(&q->tail, t, memory_order_release);
+    }
+
+    uint32_t lost = q->lost; // drops after the last record (VM is done)
+    if (text) tt_finish(text, lost);
+    else err |= umt_close(bin, lost);
+    if (err) fprintf(stderr, "trace: error writing %s\n", g_trace_path);
+    return NULL;
+}
+
+/*--------------------------------- VM side -----------------------------------*/
+
+int trace_wait_space(TraceRing *q) {
+    size_t h = atomic_load_explicit(&q->head, memory_order_relaxed);
+    for (int spin = 0;; ++spin) {
+        q->tail_seen = atomic_load_explicit(&q->tail, memory_order_acquire);
+        if (h - q->tail_seen < TRACE_RING_RECS) return 1;
+        if (q->drop) return 0;
+        if (spin < TRACE_SPINS) sched_yield();
+        else nap();
+    }
+}
+
+void trace_start(void) {
+    TraceRing *q = (TraceRing*)aligned_alloc(64, sizeof(TraceRing));
+    if (!q) {
+        fprintf(stderr, "trace: out of memory\n");
+        exit(1);
+    }
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->closed, 0);
+    q->tail_seen = 0;
+    q->lost = 0;
+    const char *policy = getenv("UM_TRACE_POLICY");
+    q->drop = policy && strcmp(policy, "drop") == 0;
+
+    if (pthread_create(&g_writer, NULL, writer_main, q) != 0) {
+        fprintf(stderr, "trace: cannot start writer thread\n");
+        exit(1);
+    }
+    g_trace_ring = q;
+}
+
+void trace_stop(void) {
+    TraceRing *q = g_trace_ring;
+    if (!q) return;
+    g_trace_ring = NULL;
+    atomic_store_explicit(&q->closed, 1, memory_order_release);
+    pthread_join(g_writer, NULL);
+    free(q);
+}
+
+#endif // TRACE
@@ -0,0 +1,245 @@
+// UM trace diff (um-tracediff)
+// ------------------------------------------------------------
+// Finds the first instruction where two traces of the same
+// program part ways, without holding either trace in memory.
+//
+// Either input may be a text trace (loader --trace) or a binary
+// .umt (loader --trace=FILE); the format is detected per file.
+// Both are read as the same record stream (tracefile.h):
+//   - text is memory-mapped and parsed in place, one record per
+//     "[pc=...]" line; the full register file is rebuilt from the
+//     delta lines, since every run starts with all registers 0.
+//   - binary is decompressed block by block (umt_next).
+// Records are compared on kind, pc, word and all eight registers.
+//
+// Output: nothing and status 0 when the traces agree; otherwise
+// the record number, the last few common records, the next few
+// from each side and what differs, with status 1 (2 on errors),
+// like cmp.
+//
+// CLI:
+//   usage: um-tracediff [-C N] <a.trace|a.umt> <b.trace|b.umt>
+//     -C N   Records of context before and after (default 3)
+// ------------------------------------------------------------
+#define _POSIX_C_SOURCE 200809L // pread, fdopen
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tracefile.h"
+
+#define CTX_MAX 64u
+
+typedef struct {
+    const char *name;
+    // text: mapped file and parse position
+    const char *map, *p, *end;
+    size_t size;
+    unsigned long line; // of the last record returned
+    unsigned long next_line;
+    uint32_t r[8]; // registers as rebuilt so far
+    uint32_t dropped; // for the next record
+    int lossy; // registers unknown after dropped records
+    // binary
+    FILE *f;
+    UMTReader *umt;
+} Src;
+
+static void die(const char *name, const char *what) {
+    fprintf(stderr, "um-tracediff: %s: %s\n", name, what);
+    exit(2);
+}
+
+static void src_open(Src *s, const char *path) {
+    memset(s, 0, sizeof *s);
+    s->name = path;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) die(path, strerror(errno));
+    struct stat st;
+    if (fstat(fd, &st) != 0) die(path, strerror(errno));
+
+    char magic[4];
+    if (st.st_size >= 4 && pread(fd, magic, 4, 0) == 4 && memcmp(magic, "UMT1", 4) == 0) {
+        s->f = fdopen(fd, "rb");
+        if (!s->f || !(s->umt = umt_open(s->f))) die(path, "not a binary UM trace");
+        return;
+    }
+    s->size = (size_t)st.st_size;
+    if (s->size) {
+        void *m = mmap(NULL, s->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m == MAP_FAILED) die(path, strerror(errno));
+        posix_madvise(m, s->size, POSIX_MADV_SEQUENTIAL);
+        s->map = (const char*)m;
+    }
+    close(fd);
+    s->p = s->map;
+    s->end = s->map + s->size;
+    s->next_line = 1;
+}
+
+static void src_close(Src *s) {
+    if (s->umt) {
+        umt_free(s->umt);
+        fclose(s->f);
+    } else if (s->map) {
+        munmap((void*)s->map, s->size);
+    }
+}
+
+/* decimal / hex field at *pp; 0 if there is none */
+static int num(const char **pp, const char *end, int base, uint32_t *v) {
+    const char *p = *pp;
+    uint64_t x = 0;
+    int digits = 0;
+    for (; p < end; ++p, ++digits) {
+        unsigned d;
+        if (*p >= '0' && *p <= '9') d = (unsigned)(*p - '0');
+        else if (base == 16 && *p >= 'a' && *p <= 'f') d = (unsigned)(*p - 'a' + 10);
+        else break;
+        x = x * (unsigned)base + d;
+        if (x > UINT32_MAX) return 0;
+    }
+    *pp = p;
+    *v = (uint32_t)x;
+    return digits > 0;
+}
+
+static int lit(const char **pp, const char *end, const char *s) {
+    size_t n = strlen(s);
+    if ((size_t)(end - *pp) < n || memcmp(*pp, s, n) != 0) return 0;
+    *pp += n;
+    return 1;
+}
+
+/* next text record: 1, or 0 at the end. Lines that are neither records nor
+   register deltas (alloc notes, program output, the drop total) are skipped. */
+static int text_next(Src *s, TraceRec *e) {
+    while (s->p < s->end) {
+        const char *p = s->p;
+        const char *nl = memchr(p, '\n', (size_t)(s->end - p));
+        const char *eol = nl ? nl : s->end;
+        s->p = nl ? nl + 1 : s->end;
+        unsigned long line = s->next_line++;
+        uint32_t a, b;
+
+        if (lit(&p, eol, "   r") && num(&p, eol, 10, &a) && a < 8 && lit(&p, eol, ": ") &&
+            num(&p, eol, 10, &b) && lit(&p, eol, " -> ") && num(&p, eol, 10, &b)) {
+            s->r[a] = b;
+        } else if (lit(&p, eol, "[pc=") && num(&p, eol, 10, &a) && lit(&p, eol, "] 0x") &&
+                   num(&p, eol, 16, &b)) {
+            e->kind = TR_INSN;
+            e->pc = a;
+            e->w = b;
+            e->dropped = s->dropped;
+            memcpy(e->r, s->r, sizeof e->r);
+            s->dropped = 0;
+            s->line = line;
+            return 1;
+        } else if (lit(&p, eol, "[trace disabled after pc=") && num(&p, eol, 10, &a)) {
+            memset(e, 0, sizeof *e);
+            e->kind = TR_STOP;
+            e->pc = a;
+            memcpy(e->r, s->r, sizeof e->r);
+            s->line = line;
+            return 1;
+        } else if (lit(&p, eol, "[trace: ") && num(&p, eol, 10, &a) && lit(&p, eol, " records dropped]") &&
+                   p == eol) {
+            s->dropped += a;
+            s->lossy = 1; // the lost records' deltas are missing
+        }
+    }
+    return 0;
+}
+
+static int src_next(Src *s, TraceRec *e) {
+    if (!s->umt) return text_next(s, e);
+    uint64_t lost;
+    int got = umt_next(s->umt, e, &lost);
+    if (got < 0) die(s->name, "truncated or corrupt trace");
+    return got;
+}
+
+static void show(const char *tag, unsigned long long n, const TraceRec *e) {
+    char buf[160];
+    trace_format(buf, sizeof buf, e);
+    printf("%s #%-10llu %s\n", tag, n, buf);
+}
+
+static void where(const Src *s) {
+    if (s->umt) printf("  %s: binary trace\n", s->name);
+    else printf("  %s: line %lu\n", s->name, s->line);
+}
+
+int main(int argc, char **argv) {
+    unsigned ctx = 3;
+    if (argc > 2 && strcmp(argv[1], "-C") == 0) {
+        ctx = (unsigned)strtoul(argv[2], NULL, 10);
+        if (ctx > CTX_MAX) ctx = CTX_MAX;
+        argc -= 2;
+        argv += 2;
+    }
+    if (argc != 3) {
+        fprintf(stderr, "usage: um-tracediff [-C N] <a.trace|a.umt> <b.trace|b.umt>\n");
+        return 2;
+    }
+    Src a, b;
+    src_open(&a, argv[1]);
+    src_open(&b, argv[2]);
+
+    TraceRec hist[CTX_MAX]; // last ctx common records
+    TraceRec ea, eb;
+    unsigned long long n = 0;
+    int ga, gb;
+    for (;; ++n) {
+        ga = src_next(&a, &ea);
+        gb = src_next(&b, &eb);
+        if (!ga || !gb) break;
+        int regs = !a.lossy && !b.lossy; // text after a drop: pc/word only
+        if (ea.kind != eb.kind || ea.pc != eb.pc || ea.w != eb.w ||
+            (regs && memcmp(ea.r, eb.r, sizeof ea.r) != 0)) {
+            break;
+        }
+        if (ctx) hist[n % ctx] = ea;
+    }
+    if (!ga && !gb) {
+        src_close(&a);
+        src_close(&b);
+        return 0; // same
+    }
+
+    printf("traces differ at record %llu\n", n);
+    if (ga) where(&a);
+    if (gb) where(&b);
+    unsigned long long from = n > ctx ? n - ctx : 0;
+    for (unsigned long long k = from; k < n; ++k) show(" ", k, &hist[k % ctx]);
+
+    if (!ga || !gb) {
+        printf("%s ends after %llu records\n", (!ga ? a.name : b.name), n);
+    } else {
+        if (ea.pc != eb.pc) printf("  pc: %u vs %u\n", ea.pc, eb.pc);
+        if (ea.w != eb.w) printf("  word: 0x%08x vs 0x%08x\n", ea.w, eb.w);
+        if (ea.kind != eb.kind) printf("  trace stopped in one only\n");
+        for (int i = 0; i < 8; ++i) {
+            if (ea.r[i] != eb.r[i] && !a.lossy && !b.lossy) {
+                printf("  r%d: %u vs %u (before this instruction)\n", i, ea.r[i], eb.r[i]);
+            }
+        }
+    }
+    // then a few records from each side
+    for (unsigned k = 0; k < ctx + 1 && ga; ++k) {
+        show("<", n + k, &ea);
+        ga = src_next(&a, &ea);
+    }
+    for (unsigned k = 0; k < ctx + 1 && gb; ++k) {
+        show(">", n + k, &eb);
+        gb = src_next(&b, &eb);
+    }
+    src_close(&a);
+    src_close(&b);
+    return 1;
+}
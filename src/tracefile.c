@@ -0,0 +1,367 @@
+// UM instruction trace formats: text and binary (.umt)
+// -----------------------------------------------------------------------------
+// Text is the classic --trace output: one line per instruction, then its
+// alloc/dealloc note and register deltas.
+//
+// A .umt file is "UMT1" followed by blocks:
+//
+//   u32 raw_len, u32 comp_len   little-endian; comp_len 0: stored uncompressed
+//   bytes                       lz_compress'd encoded records (lz.h)
+//
+// Records never straddle blocks. Each record is delta-encoded against the
+// one before it:
+//
+//   flags     bit0 TR_STOP, bit1 dropped count follows,
+//             bit2 pc is not previous pc + 1 (zigzag pc delta follows),
+//             bit3 word not in the pc-indexed word cache (u32 follows),
+//             0x80 alone: trailer (then the count lost at the end)
+//   regmask   registers that differ from the previous record
+//   then      [dropped varint] [pc delta varint] [word, u32le], and one
+//             zigzag varint delta per register in regmask
+//
+// so a straight-line instruction costs about 3 bytes instead of the ~60
+// text bytes, and loops repeat byte-for-byte for the LZ stage to fold.
+// -----------------------------------------------------------------------------
+#include <errno.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tracefile.h"
+#include "lz.h"
+#include "um.h"
+
+#define TT_CHUNK 65536u // bytes formatted per write
+
+#define UMT_MAGIC "UMT1"
+#define UMT_BLOCK 65536u // encoded bytes per block
+#define UMT_REC_MAX 64u // longest encoded record (flags..8 deltas)
+#define UMT_WCACHE 4096u // word cache entries (by pc), power of two
+
+enum {
+    F_STOP = 1, F_DROPPED = 2, F_PC_JUMP = 4, F_WORD = 8,
+    F_TRAILER = 0x80,
+};
+
+/* pretty names for trace */
+static const char *opname(unsigned op) {
+    switch (op) {
+        case 0: return "cmov";
+        case 1: return "aidx";
+        case 2: return "aupd";
+        case 3: return "add";
+        case 4: return "mul";
+        case 5: return "div";
+        case 6: return "nand";
+        case 7: return "halt";
+        case 8: return "alloc";
+        case 9: return "dealloc";
+        case 10: return "out";
+        case 11: return "in";
+        case 12: return "loadprog";
+        case 13: return "loadimm";
+        default: return "?";
+    }
+}
+
+/*----------------------------------- text ------------------------------------*/
+
+struct TraceText {
+    FILE *out;
+    char buf[TT_CHUNK];
+    size_t len;
+    TraceRec prev; // last instruction printed, awaiting its results
+    int have_prev;
+    uint64_t dropped;
+};
+
+TraceText *tt_new(FILE *out) {
+    TraceText *t = (TraceText*)calloc(1, sizeof *t);
+    if (t) t->out = out;
+    return t;
+}
+
+void tt_flush(TraceText *t) {
+    if (t->len) fwrite(t->buf, 1, t->len, t->out);
+    t->len = 0;
+}
+
+static void tt_printf(TraceText *t, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void tt_printf(TraceText *t, const char *fmt, ...) {
+    if (TT_CHUNK - t->len < 256) tt_flush(t); // one line is far shorter
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(t->buf + t->len, TT_CHUNK - t->len, fmt, ap);
+    va_end(ap);
+    if (n > 0) t->len += (size_t)n;
+}
+
+/* what prev did, now that `after` holds the registers it left behind */
+static void tt_results(TraceText *t, const TraceRec *prev, const uint32_t after[8]) {
+    uint32_t w = prev->w;
+    if (OPC(w) == 8) {
+        tt_printf(t, "    alloc -> id=%u, len=%u\n", after[ABC_B(w)], prev->r[ABC_C(w)]);
+    } else if (OPC(w) == 9) {
+        tt_printf(t, "    dealloc id=%u\n", prev->r[ABC_C(w)]);
+    }
+    for (int i = 0; i < 8; ++i) {
+        if (prev->r[i] != after[i]) {
+            tt_printf(t, "   r%d: %u -> %u\n", i, prev->r[i], after[i]);
+        }
+    }
+}
+
+int trace_format(char *buf, size_t cap, const TraceRec *e) {
+    uint32_t w = e->w;
+    unsigned op = OPC(w);
+    if (e->kind == TR_STOP) return snprintf(buf, cap, "[trace disabled after pc=%u]", e->pc);
+    if (op == 13u) {
+        return snprintf(buf, cap, "[pc=%u] 0x%08x %-8s A=%u imm=%u", e->pc, w, opname(op), LI_A(w), LI_VAL(w));
+    }
+    unsigned A = ABC_A(w), B = ABC_B(w), C = ABC_C(w);
+    return snprintf(buf, cap, "[pc=%u] 0x%08x %-8s A=%u B=%u C=%u | rA=%u rB=%u rC=%u",
+                    e->pc, w, opname(op), A, B, C, e->r[A], e->r[B], e->r[C]);
+}
+
+void tt_record(TraceText *t, const TraceRec *e) {
+    if (e->dropped) {
+        // prev's results are lost with the records after it
+        tt_printf(t, "[trace: %u records dropped]\n", e->dropped);
+        t->dropped += e->dropped;
+    } else if (t->have_prev) {
+        tt_results(t, &t->prev, e->r);
+    }
+    t->have_prev = 0;
+
+    if (TT_CHUNK - t->len < 256) tt_flush(t);
+    int n = trace_format(t->buf + t->len, TT_CHUNK - t->len, e);
+    if (n > 0) t->len += (size_t)n;
+    t->buf[t->len++] = '\n';
+    if (e->kind == TR_STOP) return;
+    t->prev = *e;
+    t->have_prev = 1;
+}
+
+void tt_finish(TraceText *t, uint64_t lost) {
+    if (lost) tt_printf(t, "[trace: %llu records dropped]\n", (unsigned long long)lost);
+    t->dropped += lost;
+    if (t->dropped) tt_printf(t, "[trace: %llu records dropped in total]\n", (unsigned long long)t->dropped);
+    tt_flush(t);
+    free(t);
+}
+
+/*------------------------------ delta coding ---------------------------------*/
+
+/* state both sides keep in step */
+typedef struct {
+    uint32_t pc; // previous record's
+    uint32_t r[8];
+    uint32_t words[UMT_WCACHE]; // last word seen at each pc slot
+} UMTState;
+
+static void state_init(UMTState *s) {
+    memset(s, 0, sizeof *s);
+    s->pc = UINT32_MAX; // the first record at pc 0 is "previous + 1"
+}
+
+static void put_u32le(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static uint32_t get_u32le(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint8_t *put_varint(uint8_t *p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static uint32_t zigzag(uint32_t d) { return (d << 1) ^ (uint32_t)-(int32_t)(d >> 31); }
+static uint32_t unzigzag(uint32_t z) { return (z >> 1) ^ (uint32_t)-(int32_t)(z & 1); }
+
+static uint8_t *encode(UMTState *s, const TraceRec *e, uint8_t *p) {
+    uint8_t *flags = p++, *mask = p++;
+    *flags = 0;
+    *mask = 0;
+    if (e->kind == TR_STOP) *flags |= F_STOP;
+    if (e->dropped) {
+        *flags |= F_DROPPED;
+        p = put_varint(p, e->dropped);
+    }
+    if (e->pc != s->pc + 1) {
+        *flags |= F_PC_JUMP;
+        p = put_varint(p, zigzag(e->pc - (s->pc + 1)));
+    }
+    uint32_t *cached = &s->words[e->pc & (UMT_WCACHE - 1)];
+    if (*cached != e->w) {
+        *flags |= F_WORD;
+        put_u32le(p, e->w);
+        p += 4;
+        *cached = e->w;
+    }
+    for (int i = 0; i < 8; ++i) {
+        if (e->r[i] != s->r[i]) {
+            *mask |= (uint8_t)(1u << i);
+            p = put_varint(p, zigzag(e->r[i] - s->r[i]));
+            s->r[i] = e->r[i];
+        }
+    }
+    s->pc = e->pc;
+    return p;
+}
+
+/*--------------------------------- writer ------------------------------------*/
+
+struct UMTWriter {
+    FILE *f;
+    UMTState st;
+    size_t len;
+    int err;
+    uint8_t raw[UMT_BLOCK];
+    uint8_t comp[LZ_BOUND(UMT_BLOCK)];
+};
+
+static void umt_flush_block(UMTWriter *w) {
+    if (w->len == 0) return;
+    size_t clen = lz_compress(w->raw, w->len, w->comp);
+    int stored = clen >= w->len;
+    uint8_t hdr[8];
+    put_u32le(hdr, (uint32_t)w->len);
+    put_u32le(hdr + 4, stored ? 0u : (uint32_t)clen);
+    if (fwrite(hdr, 1, sizeof hdr, w->f) != sizeof hdr ||
+        fwrite(stored ? w->raw : w->comp, 1, stored ? w->len : clen, w->f) != (stored ? w->len : clen)) {
+        w->err = 1;
+    }
+    w->len = 0;
+}
+
+UMTWriter *umt_create(const char *path) {
+    UMTWriter *w = (UMTWriter*)malloc(sizeof *w);
+    if (!w) return NULL;
+    if (!(w->f = fopen(path, "wb"))) {
+        int e = errno;
+        free(w);
+        errno = e;
+        return NULL;
+    }
+    state_init(&w->st);
+    w->len = 0;
+    w->err = fwrite(UMT_MAGIC, 1, 4, w->f) != 4;
+    return w;
+}
+
+int umt_record(UMTWriter *w, const TraceRec *e) {
+    if (UMT_BLOCK - w->len < UMT_REC_MAX) umt_flush_block(w);
+    w->len = (size_t)(encode(&w->st, e, w->raw + w->len) - w->raw);
+    return w->err ? -1 : 0;
+}
+
+int umt_close(UMTWriter *w, uint64_t lost) {
+    if (UMT_BLOCK - w->len < UMT_REC_MAX) umt_flush_block(w);
+    w->raw[w->len++] = F_TRAILER;
+    w->len = (size_t)(put_varint(w->raw + w->len, lost) - w->raw);
+    umt_flush_block(w);
+    int err = w->err | (fclose(w->f) != 0);
+    free(w);
+    return err ? -1 : 0;
+}
+
+/*--------------------------------- reader ------------------------------------*/
+
+struct UMTReader {
+    FILE *f;
+    UMTState st;
+    size_t pos, len;
+    uint8_t raw[UMT_BLOCK];
+    uint8_t comp[LZ_BOUND(UMT_BLOCK)];
+};
+
+UMTReader *umt_open(FILE *in) {
+    char magic[4];
+    if (fread(magic, 1, 4, in) != 4 || memcmp(magic, UMT_MAGIC, 4) != 0) return NULL;
+    UMTReader *r = (UMTReader*)malloc(sizeof *r);
+    if (!r) return NULL;
+    r->f = in;
+    state_init(&r->st);
+    r->pos = r->len = 0;
+    return r;
+}
+
+void umt_free(UMTReader *r) {
+    free(r);
+}
+
+/* next block into raw; 0, or -1 at a truncated or malformed one */
+static int umt_load_block(UMTReader *r) {
+    uint8_t hdr[8];
+    if (fread(hdr, 1, sizeof hdr, r->f) != sizeof hdr) return -1;
+    size_t len = get_u32le(hdr), clen = get_u32le(hdr + 4);
+    if (len == 0 || len > UMT_BLOCK || clen > sizeof r->comp) return -1;
+    if (clen == 0) {
+        if (fread(r->raw, 1, len, r->f) != len) return -1;
+    } else {
+        if (fread(r->comp, 1, clen, r->f) != clen) return -1;
+        if (lz_decompress(r->comp, clen, r->raw, len) != len) return -1;
+    }
+    r->pos = 0;
+    r->len = len;
+    return 0;
+}
+
+static int get_varint(UMTReader *r, uint64_t *v) {
+    *v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (r->pos >= r->len) return -1;
+        uint8_t b = r->raw[r->pos++];
+        *v |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) return 0;
+    }
+    return -1;
+}
+
+static int get_u32var(UMTReader *r, uint32_t *v) {
+    uint64_t x;
+    if (get_varint(r, &x) != 0 || x > UINT32_MAX) return -1;
+    *v = (uint32_t)x;
+    return 0;
+}
+
+int umt_next(UMTReader *r, TraceRec *e, uint64_t *lost) {
+    if (r->pos == r->len && umt_load_block(r) != 0) return -1;
+    uint8_t flags = r->raw[r->pos++];
+    if (flags == F_TRAILER) return get_varint(r, lost) == 0 ? 0 : -1;
+    if (flags & ~(F_STOP | F_DROPPED | F_PC_JUMP | F_WORD) || r->pos >= r->len) return -1;
+    uint8_t mask = r->raw[r->pos++];
+    UMTState *s = &r->st;
+
+    e->kind = (flags & F_STOP) ? TR_STOP : TR_INSN;
+    e->dropped = 0;
+    if ((flags & F_DROPPED) && get_u32var(r, &e->dropped) != 0) return -1;
+    uint32_t d = 0;
+    if ((flags & F_PC_JUMP) && get_u32var(r, &d) != 0) return -1;
+    e->pc = s->pc + 1 + unzigzag(d);
+    uint32_t *cached = &s->words[e->pc & (UMT_WCACHE - 1)];
+    if (flags & F_WORD) {
+        if (r->len - r->pos < 4) return -1;
+        *cached = get_u32le(r->raw + r->pos);
+        r->pos += 4;
+    }
+    e->w = *cached;
+    for (int i = 0; i < 8; ++i) {
+        if (mask & (1u << i)) {
+            if (get_u32var(r, &d) != 0) return -1;
+            s->r[i] += unzigzag(d);
+        }
+        e->r[i] = s->r[i];
+    }
+    s->pc = e->pc;
+    return 1;
+}
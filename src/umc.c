@@ -0,0 +1,197 @@
+// UM pre-decoded program images (.umc)
+// -----------------------------------------------------------------------------
+// A .um file is big-endian and every run byte-swaps it into a fresh buffer. A
+// .umc holds the same program already in the form the emulator runs:
+//
+//   UMCHeader (64 bytes)
+//   words[nwords + 1]   native endian, last one is UM_SENTINEL
+//   sel[nwords]         uint16 operand selectors (umc_sel), for the decoder
+//
+// so the loader maps it MAP_PRIVATE read/write and points array 0 straight at
+// `words`: no read loop, no swapping, and pages the program never writes stay
+// shared with the page cache.
+//
+// Mapping touches only the header and the sentinel. Selectors are not
+// checked against their words: the decoder masks each one to its op's
+// handler table (umc_sel_mask), so a wrong one picks a wrong handler of
+// that op, never memory past a table.
+//
+// Staleness: a .umc made from a .um records that file's size and mtime. When
+// the .um is still around and no longer matches, umc_map reports the image as
+// stale and the loader falls back to the .um. Files from another byte order
+// or format version are rejected as malformed.
+//
+// Shared images (loader --shm): the same file format, written under a tmpfs
+// directory (/dev/shm) with a name derived from the .um's identity. Every
+// process mapping it shares the clean pages; writes into array 0 copy only
+// the touched pages.
+//
+// Anyone can create files in /dev/shm and the name is predictable, so a
+// shared image is only used if it is this user's own and writable by no one
+// else (umc_map_shared): nobody else can have planted it or change it under
+// the mapping. Our own stale images fail the size/mtime check like a .umc.
+// -----------------------------------------------------------------------------
+#define _POSIX_C_SOURCE 200809L // mkstemp, fdopen, st_mtim
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "umc.h"
+
+#define UMC_MAGIC 0x31434D55u // "UMC1" on little-endian hosts
+#define UMC_VERSION 1u
+#define UMC_BOM 0x01020304u // reads back differently on a foreign-endian host
+
+#if defined(__APPLE__)
+# define UMC_MTIME_NS(st) ((st)->st_mtimespec.tv_nsec)
+#else
+# define UMC_MTIME_NS(st) ((st)->st_mtim.tv_nsec)
+#endif
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t bom;
+    uint32_t has_src; // 1: src_* describe the .um this was made from
+    uint64_t nwords;
+    uint64_t src_size;
+    int64_t src_mtime_sec;
+    int64_t src_mtime_nsec;
+    uint64_t sel_off; // byte offset of sel[]; words[] follow the header
+    uint64_t file_size;
+} UMCHeader;
+
+_Static_assert(sizeof(UMCHeader) == 64, "UMCHeader layout");
+
+int umc_write(const char *path, const uint32_t *words, size_t nwords, const struct stat *src) {
+    char tmp[4096];
+    int n = snprintf(tmp, sizeof tmp, "%s.XXXXXX", path);
+    if (n < 0 || (size_t)n >= sizeof tmp) return -1;
+
+    UMCHeader h = {
+        .magic = UMC_MAGIC,
+        .version = UMC_VERSION,
+        .bom = UMC_BOM,
+        .nwords = nwords,
+        .sel_off = sizeof h + (nwords + 1) * sizeof(uint32_t),
+    };
+    h.file_size = h.sel_off + nwords * sizeof(uint16_t);
+    if (src) {
+        h.has_src = 1;
+        h.src_size = (uint64_t)src->st_size;
+        h.src_mtime_sec = (int64_t)src->st_mtime;
+        h.src_mtime_nsec = (int64_t)UMC_MTIME_NS(src);
+    }
+
+    int fd = mkstemp(tmp);
+    if (fd < 0) return -1;
+    FILE *f = fdopen(fd, "wb");
+    if (!f) {
+        close(fd);
+        unlink(tmp);
+        return -1;
+    }
+
+    const uint32_t sentinel = UM_SENTINEL;
+    int ok = fwrite(&h, sizeof h, 1, f) == 1 &&
+             fwrite(words, sizeof *words, nwords, f) == nwords &&
+             fwrite(&sentinel, sizeof sentinel, 1, f) == 1;
+
+    // selectors in chunks, so big images need no second full-size buffer
+    uint16_t sel[1024];
+    for (size_t i = 0; ok && i < nwords; i += 1024) {
+        size_t k = nwords - i < 1024 ? nwords - i : 1024;
+        for (size_t j = 0; j < k; ++j) sel[j] = umc_sel(words[i + j]);
+        ok = fwrite(sel, sizeof *sel, k, f) == k;
+    }
+    if (fclose(f) != 0) ok = 0;
+    // mkstemp creates 0600; a .umc is as readable as the program it caches
+    if (ok) chmod(tmp, 0644);
+
+    if (!ok || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/* umc_map on an open file (closed here); owned: also require a regular file
+   of this user's that no one else can write */
+static int map_fd(UMCImage *img, int fd, const struct stat *src, int owned) {
+    memset(img, 0, sizeof *img);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(UMCHeader) ||
+        (owned && (!S_ISREG(st.st_mode) || st.st_uid != geteuid() || (st.st_mode & 022)))) {
+        close(fd);
+        return -1;
+    }
+
+    size_t size = (size_t)st.st_size;
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    const UMCHeader *h = (const UMCHeader*)map;
+    int bad = h->magic != UMC_MAGIC || h->version != UMC_VERSION || h->bom != UMC_BOM ||
+              h->file_size != size || h->nwords > (size - sizeof *h) / sizeof(uint32_t) ||
+              h->sel_off != sizeof *h + (h->nwords + 1) * sizeof(uint32_t) ||
+              h->sel_off + h->nwords * sizeof(uint16_t) != size;
+    if (bad) {
+        munmap(map, size);
+        return -1;
+    }
+    if (src && h->has_src &&
+        (h->src_size != (uint64_t)src->st_size ||
+         h->src_mtime_sec != (int64_t)src->st_mtime ||
+         h->src_mtime_nsec != (int64_t)UMC_MTIME_NS(src))) {
+        munmap(map, size);
+        return 1;
+    }
+
+    img->map = map;
+    img->size = size;
+    img->nwords = (size_t)h->nwords;
+    img->words = (uint32_t*)((unsigned char*)map + sizeof *h);
+    img->sel = (const uint16_t*)((unsigned char*)map + h->sel_off);
+    if (img->words[img->nwords] != UM_SENTINEL) {
+        umc_unmap(img);
+        return -1;
+    }
+    return 0;
+}
+
+int umc_map(UMCImage *img, const char *path, const struct stat *src) {
+    return map_fd(img, open(path, O_RDONLY), src, 0);
+}
+
+int umc_map_shared(UMCImage *img, const char *path, const struct stat *src) {
+    return map_fd(img, open(path, O_RDONLY | O_NOFOLLOW), src, 1) == 0 ? 0 : -1;
+}
+
+void umc_unmap(UMCImage *img) {
+    if (img->map) munmap(img->map, img->size);
+    memset(img, 0, sizeof *img);
+}
+
+int umc_shm_path(char *buf, size_t cap, const char *dir, const struct stat *src) {
+    uint64_t id[5] = {
+        (uint64_t)src->st_dev, (uint64_t)src->st_ino, (uint64_t)src->st_size,
+        (uint64_t)src->st_mtime, (uint64_t)UMC_MTIME_NS(src),
+    };
+    uint64_t h = 0xCBF29CE484222325ull; // FNV-1a
+    const unsigned char *b = (const unsigned char*)id;
+    for (size_t i = 0; i < sizeof id; ++i) {
+        h ^= b[i];
+        h *= 0x100000001B3ull;
+    }
+    int n = snprintf(buf, cap, "%s/um-%016llx.umc", dir, (unsigned long long)h);
+    return (n < 0 || (size_t)n >= cap) ? -1 : 0;
+}
@@ -0,0 +1,74 @@
+// UM binary trace reader (um-trace)
+// ------------------------------------------------------------
+// Turns a .umt file written by `loader --trace=FILE` back into the
+// text trace `loader --trace` prints, decompressing block by block
+// as it goes (tracefile.c), so a trace of any length streams
+// through in constant memory.
+//
+// CLI:
+//   usage: um-trace [--stats] <trace.umt | ->
+//     --stats  Also report records and sizes on stderr (text size
+//              only when stdout is a file)
+//
+// Error handling: fail fast with a short diagnostic.
+// ------------------------------------------------------------
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tracefile.h"
+
+int main(int argc, char **argv) {
+    int stats = 0;
+    if (argc > 1 && strcmp(argv[1], "--stats") == 0) {
+        stats = 1;
+        argc--;
+        argv++;
+    }
+    if (argc != 2) {
+        fprintf(stderr, "usage: um-trace [--stats] <trace.umt | ->\n");
+        return 2;
+    }
+
+    FILE *in = strcmp(argv[1], "-") == 0 ? stdin : fopen(argv[1], "rb");
+    if (!in) {
+        fprintf(stderr, "cannot open %s: %s\n", argv[1], strerror(errno));
+        return 1;
+    }
+    UMTReader *r = umt_open(in);
+    if (!r) {
+        fprintf(stderr, "%s: not a binary UM trace\n", argv[1]);
+        return 1;
+    }
+    TraceText *text = tt_new(stdout);
+    if (!text) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    TraceRec e;
+    uint64_t lost = 0, nrec = 0;
+    int got;
+    while ((got = umt_next(r, &e, &lost)) == 1) {
+        tt_record(text, &e);
+        nrec++;
+    }
+    tt_finish(text, got == 0 ? lost : 0);
+    umt_free(r);
+
+    if (stats) {
+        long size = ftell(in);
+        long text_size = ftell(stdout); // -1 on a pipe
+        fprintf(stderr, "%llu records, %ld bytes (%.2f per record)", (unsigned long long)nrec, size,
+                nrec ? (double)size / (double)nrec : 0.0);
+        if (text_size > 0) fprintf(stderr, ", text %ld bytes (%.1fx)", text_size, (double)text_size / (double)size);
+        fputc('\n', stderr);
+    }
+    if (in != stdin) fclose(in);
+    if (got < 0) {
+        fprintf(stderr, "%s: truncated or corrupt trace\n", argv[1]);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,106 @@
+// UM large zero-fills (alloc, --zero)
+// -----------------------------------------------------------------------------
+// calloc of a large array gets fresh anonymous pages that the kernel zeroes
+// one by one on first touch, so `alloc` itself is cheap and the cost is spread
+// over the program's first pass: a page fault per page, plus the munmap when
+// it is freed. Recycled memory avoids both, but has to be zeroed eagerly.
+//
+// zero_fill splits a fill into one slice per worker thread. Each slice is
+// written with 16-byte non-temporal stores (SSE2), which skip the cache that
+// gigabytes of zeros would only evict, and fenced at the end. Without SSE2
+// each slice is a plain memset.
+//
+// --zero=parallel makes `alloc` of ZERO_PAR_MIN bytes and up take back a
+// block of the same size still queued for the reclaimer (reclaim.c), as a
+// program that frees and reallocates large buffers in a loop does, and
+// zero_fill it. Without one it stays calloc: filling fresh pages up front
+// only moves the faults into `alloc` (BUILD/zerobench compares them all).
+// -----------------------------------------------------------------------------
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "zero.h"
+#include "reclaim.h"
+
+#define ZERO_MAX_THREADS 16u
+#define ZERO_MIN_SLICE ((size_t)16 << 20) // bytes per thread, at least
+
+int g_zero_mode = UM_ZERO_CALLOC;
+
+typedef struct {
+    unsigned char *p;
+    size_t bytes;
+} ZeroSlice;
+
+/* zero one slice, streaming the aligned middle */
+static void *zero_slice(void *arg) {
+    ZeroSlice *s = (ZeroSlice*)arg;
+    unsigned char *p = s->p, *end = s->p + s->bytes;
+#ifdef __SSE2__
+    unsigned char *a = (unsigned char*)(((uintptr_t)p + 15u) & ~(uintptr_t)15u);
+    unsigned char *b = (unsigned char*)((uintptr_t)end & ~(uintptr_t)15u);
+    if (a < b) {
+        memset(p, 0, (size_t)(a - p));
+        const __m128i z = _mm_setzero_si128();
+        unsigned char *q = a;
+        for (; q + 64 <= b; q += 64) {
+            _mm_stream_si128((__m128i*)q, z);
+            _mm_stream_si128((__m128i*)(q + 16), z);
+            _mm_stream_si128((__m128i*)(q + 32), z);
+            _mm_stream_si128((__m128i*)(q + 48), z);
+        }
+        for (; q < b; q += 16) _mm_stream_si128((__m128i*)q, z);
+        _mm_sfence(); // streamed stores are weakly ordered
+        p = b;
+    }
+#endif
+    memset(p, 0, (size_t)(end - p));
+    return NULL;
+}
+
+void zero_fill(void *p, size_t bytes, unsigned threads) {
+    if (threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (unsigned)cpus : 1u;
+    }
+    if (threads > ZERO_MAX_THREADS) threads = ZERO_MAX_THREADS;
+    if (threads > bytes / ZERO_MIN_SLICE) threads = (unsigned)(bytes / ZERO_MIN_SLICE);
+    if (threads == 0) threads = 1;
+
+    // page-aligned slices, so no two threads fault on the same page
+    size_t per = (bytes / threads + 4095u) & ~(size_t)4095u;
+    ZeroSlice s[ZERO_MAX_THREADS];
+    pthread_t t[ZERO_MAX_THREADS];
+    unsigned started = 0;
+    for (unsigned i = 0; i < threads; ++i) {
+        size_t off = (size_t)i * per;
+        s[i].p = (unsigned char*)p + (off < bytes ? off : bytes);
+        s[i].bytes = off < bytes ? (bytes - off < per ? bytes - off : per) : 0;
+    }
+    // slice 0 on this thread; a worker that cannot start is done here too
+    for (unsigned i = 1; i < threads; ++i) {
+        if (pthread_create(&t[i], NULL, zero_slice, &s[i]) != 0) break;
+        started = i;
+    }
+    zero_slice(&s[0]);
+    for (unsigned i = started + 1; i < threads; ++i) zero_slice(&s[i]);
+    for (unsigned i = 1; i <= started; ++i) pthread_join(t[i], NULL);
+}
+
+void *zero_alloc(size_t n) {
+    size_t bytes = n * sizeof(uint32_t);
+    if (g_zero_mode == UM_ZERO_PARALLEL && bytes >= ZERO_PAR_MIN) {
+        void *p = reclaim_take(bytes);
+        if (p) {
+            zero_fill(p, bytes, 0);
+            return p;
+        }
+    }
+    return calloc(n, sizeof(uint32_t));
+}
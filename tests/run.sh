@@ -0,0 +1,84 @@
+#!/bin/bash
+# UM regression tests
+# -----------------------------------------------------------------------------
+# Assembles every tests/*/*.uma and runs it on the switch engine, which is the
+# reference: its stdout must equal NAME.out. A program that is meant to fail
+# has NAME.err, its expected stderr, and must exit nonzero; any other must
+# exit 0 with nothing on stderr. Each threaded-engine mode below must then
+# match the switch engine's stdout, stderr and exit status exactly.
+#
+#   tests/hoist/   loops whose bounds checks trace_hoist moves to the trace
+#                  entry (in bounds, descending, writing array 0, running off
+#                  either end, re-entered with a shorter array)
+#   tests/calls/   recursive calls and returns, including ones the shadow
+#                  return stack (--ret-stack) predicts wrong
+#
+# usage: tests/run.sh                  (make test: debug build, ASan/UBSan)
+#        LOADER=BUILD/loader-release tests/run.sh
+# -----------------------------------------------------------------------------
+cd "$(dirname "$0")/.." || exit 1
+LOADER=${LOADER:-BUILD/loader}
+ASM=${ASM:-BUILD/asm}
+
+TMP=$(mktemp -d) || exit 1
+trap 'rm -rf "$TMP"' EXIT
+
+MODES=(
+    "--engine=threaded"
+    "--engine=threaded --no-jit"
+    "--engine=threaded --ret-stack"
+    "--engine=threaded --stream"
+    "--engine=threaded --code-cache=$TMP/cc" # records
+    "--engine=threaded --code-cache=$TMP/cc" # replays
+)
+mkdir "$TMP/cc"
+
+fail=0
+count=0
+
+# run the program with the given flags; leaves out, err and status in $TMP/$2.*
+run() {
+    local um=$1 tag=$2
+    shift 2
+    "$LOADER" "$@" "$um" < /dev/null > "$TMP/$tag.out" 2> "$TMP/$tag.err"
+    echo $? > "$TMP/$tag.status"
+}
+
+bad() {
+    echo "FAIL $1: $2"
+    fail=1
+}
+
+for src in tests/*/*.uma; do
+    name=${src%.uma}
+    um="$TMP/$(basename "$name").um"
+    count=$((count + 1))
+    if ! "$ASM" "$src" -o "$um" > /dev/null; then
+        bad "$src" "does not assemble"
+        continue
+    fi
+
+    run "$um" ref --engine=switch
+    status=$(cat "$TMP/ref.status")
+    cmp -s "$TMP/ref.out" "$name.out" || bad "$src" "--engine=switch: stdout differs from $name.out"
+    if [ -f "$name.err" ]; then
+        cmp -s "$TMP/ref.err" "$name.err" || bad "$src" "--engine=switch: stderr differs from $name.err"
+        [ "$status" != 0 ] || bad "$src" "--engine=switch: exit 0, expected a failure"
+    else
+        [ -s "$TMP/ref.err" ] && bad "$src" "--engine=switch: unexpected stderr: $(head -c 200 "$TMP/ref.err")"
+        [ "$status" = 0 ] || bad "$src" "--engine=switch: exit $status"
+    fi
+
+    for mode in "${MODES[@]}"; do
+        # shellcheck disable=SC2086 # mode is a list of flags
+        run "$um" got $mode
+        for f in out err status; do
+            cmp -s "$TMP/ref.$f" "$TMP/got.$f" || bad "$src" "$mode: $f differs from --engine=switch"
+        done
+    done
+done
+
+if [ "$fail" = 0 ]; then
+    echo "tests ok: $count programs, switch engine + ${#MODES[@]} threaded modes ($LOADER)"
+fi
+exit $fail